@@ -14,6 +14,61 @@ const int BOARD_REGIONS[64] = {
   7, 7, 8, 8, 8, 8, 9, 9
 };
 
+#if FLIP_KOGGE_STONE
+namespace {
+
+// Fills from the move through the contiguous opponent discs in pro, shifting
+// left by S, with a parallel prefix. The discs are flipped only if the square
+// past the end of the fill holds an own disc.
+template <int S>
+inline uint64_t flip_left(uint64_t move, uint64_t self, uint64_t pro) {
+  uint64_t gen = move | (pro & (move << S));
+  pro &= pro << S;
+  gen |= pro & (gen << (2 * S));
+  pro &= pro << (2 * S);
+  gen |= pro & (gen << (4 * S));
+  return (gen ^ move) & -(uint64_t) ((self & (gen << S)) != 0);
+}
+
+template <int S>
+inline uint64_t flip_right(uint64_t move, uint64_t self, uint64_t pro) {
+  uint64_t gen = move | (pro & (move >> S));
+  pro &= pro >> S;
+  gen |= pro & (gen >> (2 * S));
+  pro &= pro >> (2 * S);
+  gen |= pro & (gen >> (4 * S));
+  return (gen ^ move) & -(uint64_t) ((self & (gen >> S)) != 0);
+}
+
+}  // namespace
+#endif
+
+// FLIP_COUNT[x][line] is the number of discs flipped by a move at x on a full
+// line of eight squares, where the set bits of line are the mover's discs.
+uint8_t FLIP_COUNT[8][256];
+
+bool init_flip_count() {
+  for (int x = 0; x < 8; x++) {
+    for (int line = 0; line < 256; line++) {
+      int flips = 0;
+      int i = x + 1;
+      while (i < 8 && !(line & (1 << i)))
+        i++;
+      if (i < 8)
+        flips += i - x - 1;
+      i = x - 1;
+      while (i >= 0 && !(line & (1 << i)))
+        i--;
+      if (i >= 0)
+        flips += x - i - 1;
+      FLIP_COUNT[x][line] = (uint8_t) flips;
+    }
+  }
+  return true;
+}
+
+const bool FLIP_COUNT_READY = init_flip_count();
+
 uint32_t **Board::init_zobrist_table() {
   std::mt19937 rng(612801529U);
   uint32_t **table = new uint32_t *[16];
@@ -78,6 +133,21 @@ Board Board::copy() {
   return Board(pieces[WHITE], pieces[BLACK]);
 }
 
+Board Board::canonical(int *symmetry) {
+  uint64_t best_taken = occupied(), best_black = pieces[BLACK];
+  *symmetry = 0;
+  for (int s = 1; s < 8; s++) {
+    uint64_t taken = transform(occupied(), s);
+    uint64_t black = transform(pieces[BLACK], s);
+    if (taken < best_taken || (taken == best_taken && black < best_black)) {
+      best_taken = taken;
+      best_black = black;
+      *symmetry = s;
+    }
+  }
+  return Board(best_taken & ~best_black, best_black);
+}
+
 void Board::do_move(Color c, int m) {
   // A NULL move means pass.
   if (m == MOVE_NULL) return;
@@ -91,6 +161,22 @@ void Board::do_move(Color c, int m, uint64_t mask) {
   pieces[c] |= SQ_TO_BIT[m];
 }
 
+#if FLIP_KOGGE_STONE
+// Fills in all eight directions without branches or table lookups. Opponent
+// discs on the edge files can't be flipped horizontally or diagonally, which
+// also stops fills that would wrap around to the next row.
+uint64_t Board::get_do_move(Color c, int m) {
+  uint64_t move = SQ_TO_BIT[m];
+  uint64_t self = pieces[c];
+  uint64_t opp = pieces[~c];
+  uint64_t inner = opp & 0x7E7E7E7E7E7E7E7E;
+
+  return flip_left<8>(move, self, opp) | flip_right<8>(move, self, opp)
+       | flip_left<1>(move, self, inner) | flip_right<1>(move, self, inner)
+       | flip_left<7>(move, self, inner) | flip_right<7>(move, self, inner)
+       | flip_left<9>(move, self, inner) | flip_right<9>(move, self, inner);
+}
+#else
 // This algorithm gets the mask by lookup with precalculated tables in each of
 // the eight directions. A switch with the board region is used to only
 // consider certain directions for efficiency.
@@ -162,6 +248,24 @@ uint64_t Board::get_do_move(Color c, int m) {
 
   return mask;
 }
+#endif
+
+// Each line through m is gathered into a byte indexed by column, or by row for
+// the column itself. Squares off a short diagonal read as opponent discs,
+// which is harmless since a line of them never ends in an anchor.
+int Board::count_last_flips(Color c, int m) {
+  uint64_t self = pieces[c];
+  int x = move_col(m);
+  int y = move_row(m);
+
+  int flips = FLIP_COUNT[x][(self >> (8 * y)) & 0xFF];
+  flips += FLIP_COUNT[y][(((self >> x) & 0x0101010101010101) * 0x0102040810204080) >> 56];
+  uint64_t diag = NERAY[m] | SWRAY[m];
+  flips += FLIP_COUNT[x][((self & diag) * 0x0101010101010101) >> 56];
+  diag = NWRAY[m] | SERAY[m];
+  flips += FLIP_COUNT[x][((self & diag) * 0x0101010101010101) >> 56];
+  return flips;
+}
 
 void Board::undo_move(Color c, int m, uint64_t mask) {
   pieces[WHITE] ^= mask;
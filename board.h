@@ -4,6 +4,14 @@
 #include <string>
 #include "common.h"
 
+// Selects the flip generator used by get_do_move(). When true, the flips are
+// found with branchless Kogge-Stone fills in all eight directions. Otherwise,
+// the ray tables are used, only in the directions possible for the region of
+// the board the move is in.
+#ifndef FLIP_KOGGE_STONE
+#define FLIP_KOGGE_STONE false
+#endif
+
 const int SQ_VAL[64] = {
   9, 1, 7, 6, 6, 7, 1, 9,
   1, 0, 2, 3, 3, 2, 0, 1,
@@ -26,6 +34,10 @@ class Board {
   Board(const std::string& data);
   ~Board() = default;
   Board copy();
+  // Returns the board in the symmetry with the smallest (occupied, black)
+  // bitboards, so that all symmetric boards give the same result. Also gets
+  // the symmetry that maps this board to it.
+  Board canonical(int *symmetry);
 
   // Returns a simple on-the-fly Zobrist hash.
   uint32_t hash();
@@ -35,6 +47,9 @@ class Board {
   void do_move(Color c, int m, uint64_t mask);
   uint64_t get_do_move(Color c, int m);
   void undo_move(Color c, int m, uint64_t mask);
+  // Counts the discs flipped by a move at m for side c, when m is the only
+  // empty square. Much cheaper than get_do_move() for the last move.
+  int count_last_flips(Color c, int m);
 
   // Legal moves
   bool is_legal(Color c, int m);
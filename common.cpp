@@ -44,6 +44,28 @@ uint64_t reflect_diag(uint64_t i) {
   return i;
 }
 
+uint64_t transform(uint64_t i, int s) {
+  if (s & 4) i = reflect_diag(i);
+  if (s & 2) i = reflect_hor(i);
+  if (s & 1) i = reflect_vert(i);
+  return i;
+}
+
+uint64_t inverse_transform(uint64_t i, int s) {
+  if (s & 1) i = reflect_vert(i);
+  if (s & 2) i = reflect_hor(i);
+  if (s & 4) i = reflect_diag(i);
+  return i;
+}
+
+int transform_move(int m, int s) {
+  return bitscan_forward(transform(1ULL << m, s));
+}
+
+int inverse_transform_move(int m, int s) {
+  return bitscan_forward(inverse_transform(1ULL << m, s));
+}
+
 uint64_t get_time_elapsed(TimePoint start_time) {
   auto end_time = Clock::now();
   std::chrono::milliseconds time_span =
@@ -57,6 +79,16 @@ std::string print_move(int move) {
   return std::string(1, column) + std::to_string(row);
 }
 
+std::string print_pv(const std::vector<int> &pv) {
+  std::string result;
+  for (unsigned int i = 0; i < pv.size(); i++) {
+    if (i != 0)
+      result += " ";
+    result += (pv[i] == MOVE_NULL) ? "ps" : print_move(pv[i]);
+  }
+  return result;
+}
+
 int next_move(ArrayList &moves, ArrayList &scores, int index) {
   if (index >= moves.size())
     return MOVE_NULL;
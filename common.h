@@ -5,6 +5,7 @@
 #include <cstdlib>
 #include <chrono>
 #include <string>
+#include <vector>
 
 #define PRINT_SEARCH_INFO false
 
@@ -36,10 +37,18 @@ int bitscan_reverse(uint64_t i);
 uint64_t reflect_vert(uint64_t i);
 uint64_t reflect_hor(uint64_t i);
 uint64_t reflect_diag(uint64_t i);
+// The 8 symmetries of the board, numbered 0 to 7. Symmetry s reflects about
+// the diagonal if s & 4, then horizontally if s & 2, then vertically if s & 1.
+uint64_t transform(uint64_t i, int s);
+uint64_t inverse_transform(uint64_t i, int s);
+int transform_move(int m, int s);
+int inverse_transform_move(int m, int s);
 
 // Utility functions
 uint64_t get_time_elapsed(TimePoint start_time);
 std::string print_move(int move);
+// Prints a sequence of moves separated by spaces, with passes as "ps".
+std::string print_pv(const std::vector<int> &pv);
 
 class ArrayList {
  public:
@@ -77,4 +86,49 @@ class ArrayList {
 // using a partial selection sort.
 int next_move(ArrayList &moves, ArrayList &scores, int index);
 
+// Moves with their ordering scores, for search nodes. Each entry packs the
+// score and the move into one int, as score * 128 + (127 - move), so that a
+// single comparison orders by score, with ties going to the lower square.
+// Scores must fit in 24 bits.
+class MoveList {
+ public:
+  int data[32];
+  int length;
+
+  MoveList() : length(0) {}
+  // Builds the list from a legal move mask, with all scores 0
+  explicit MoveList(uint64_t legal) : length(0) {
+    while (legal) {
+      data[length++] = 127 - bitscan_forward(legal);
+      legal &= legal - 1;
+    }
+  }
+  ~MoveList() = default;
+
+  void add(int m, int score) {
+    data[length] = score * 128 + (127 - m);
+    length++;
+  }
+  int size() { return length; }
+  int move(int i) { return 127 - (data[i] & 127); }
+  void set_score(int i, int score) { data[i] = score * 128 + (data[i] & 127); }
+
+  // Retrieves the next move with the highest score starting from index using
+  // a partial selection sort, so that the list is only sorted as far as the
+  // search gets before a cutoff. Returns MOVE_NULL past the end.
+  int next(int index) {
+    if (index >= length)
+      return MOVE_NULL;
+    int best_index = index;
+    for (int i = index + 1; i < length; i++) {
+      if (data[i] > data[best_index])
+        best_index = i;
+    }
+    int temp = data[best_index];
+    data[best_index] = data[index];
+    data[index] = temp;
+    return 127 - (temp & 127);
+  }
+};
+
 #endif
@@ -1,8 +1,12 @@
 #include <algorithm>
-#include <fstream>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <iomanip>
-#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "board.h"
@@ -12,137 +16,202 @@
 
 using namespace std;
 
-vector<Node> openings;
-vector<string> stringForm;
-
-bool read_file();
-void write_file();
-
-// Checks if a position already exists in the book. If so, it returns the move
-// in the book. Otherwise, it returns -1.
-int contains(uint64_t taken, uint64_t black) {
-  for (unsigned int i = 0; i < openings.size(); i++) {
-    if ((openings[i].taken == taken) && (openings[i].black == black)) {
-      return openings[i].move;
-    }
+// Builds or extends an opening book by drop-out expansion. The book is a tree
+// from the starting position. The drop-out cost of a line is how much worse
+// its book moves score than the best book moves, summed over both sides. The
+// leaves, positions reached by a book move that are not in the book yet, are
+// expanded cheapest first. An expansion is a multi-PV search, and all of its
+// lines go in the book, so that the moves close to the best are extended too.
+//
+// Leaves are searched in batches by worker threads with their own Players.
+// The book file is rewritten after each batch, so a build can be stopped and
+// resumed, or continued later to extend the best lines deeper.
+
+namespace {
+
+struct Options {
+  string file;
+  int threads;
+  int depth;
+  int lines;
+  int positions;
+  int maxPlies;
+  // Leaves with a higher drop-out cost, in eval units, are not expanded
+  int margin;
+
+  Options()
+    : file("newbook.txt"),
+      threads(1),
+      depth(16),
+      lines(3),
+      positions(100),
+      maxPlies(20),
+      margin(4 * EVAL_SCALE_FACTOR) {}
+};
+
+struct Leaf {
+  Board b;
+  Color c;
+  int cost;
+  int plies;
+};
+
+// Finds the leaves below position b, with side c to move, reached with the
+// given drop-out cost. Keeps the cheapest way to reach each position.
+void find_leaves(Openings &book, const Options &o, Board b, Color c, int cost, int plies,
+    unordered_map<BookKey, int, BookKeyHash> &visited,
+    unordered_map<BookKey, Leaf, BookKeyHash> &leaves) {
+  if (plies >= o.maxPlies || cost > o.margin)
+    return;
+  if (!b.legal_moves(c)) {
+    if (b.legal_moves(~c))
+      find_leaves(book, o, b, ~c, cost, plies, visited, leaves);
+    return;
   }
-  return -1;
-}
 
-// Given a board and the best move for that board, adds it to the book
-void add(Board &b, int move) {
-  Node nnn;
-  nnn.move = move;
-  nnn.taken = b.occupied();
-  nnn.black = b.get_bits(BLACK);
-
-  std::stringstream stream;
-  stream << "0x" << std::setfill('0') << std::setw(16) << std::hex << b.occupied();
-  std::string taken( stream.str() );
-  std::stringstream stream2;
-  stream2 << "0x" << std::setfill('0') << std::setw(16) << std::hex << b.get_bits(BLACK);
-  std::string black( stream2.str() );
-
-  std::stringstream t;
-  t << taken << " " << black << " " << move;
-  std::string result(t.str());
-  stringForm.push_back(result);
-  openings.push_back(nnn);
-  cout << result << endl;
-}
+  int s;
+  BookKey k = book.key(b, c, &s);
+  auto seen = visited.find(k);
+  if (seen != visited.end() && seen->second <= cost)
+    return;
+  visited[k] = cost;
 
-// Recursively builds the book, considering all possible positions to a depth
-// and finding the best move
-void next(Player &p, Board &b, Color color, int plies) {
-  p.game = b;
-  Board temp = b.copy();
-
-  // Consider transpositions or previous book
-  int exists = contains(b.occupied(), b.get_bits(BLACK));
-  if (exists != -1) {
-    std::cout << "already exists. traversing." << std::endl;
-    temp.do_move(color, exists);
+  vector<BookMove> moves;
+  if (!book.get_moves(b, c, moves)) {
+    auto leaf = leaves.find(k);
+    if (leaf == leaves.end() || cost < leaf->second.cost)
+      leaves[k] = Leaf{b, c, cost, plies};
+    return;
   }
-  // Find a best move for the current position
-  else {
-    int m = p.do_move(MOVE_NULL, -1);
-    add(b, m);
-    temp.do_move(color, m);
+  for (unsigned int i = 0; i < moves.size(); i++) {
+    Board copy = b.copy();
+    copy.do_move(c, moves[i].move);
+    find_leaves(book, o, copy, ~c, cost + moves[0].score - moves[i].score, plies + 1,
+      visited, leaves);
   }
+}
 
-  if (plies <= 0) {
-    return;
-  }
+void usage(const char *name) {
+  cerr << "Usage: " << name << " [-f book] [-t threads] [-d depth] [-k lines] [-n positions]"
+       << " [-p plies] [-w margin]" << endl;
+  cerr << "  -f  book file to extend, and write to (newbook.txt)" << endl;
+  cerr << "  -t  worker threads (1)" << endl;
+  cerr << "  -d  search depth for each position (16)" << endl;
+  cerr << "  -k  best moves added for each position (3)" << endl;
+  cerr << "  -n  positions to add (100)" << endl;
+  cerr << "  -p  maximum plies from the start (20)" << endl;
+  cerr << "  -w  maximum drop-out cost in discs (4)" << endl;
+}
 
-  // for all legal replies
-  ArrayList legalMoves = temp.legal_movelist(~color);
-  for (int i = 0; i < legalMoves.size(); i++) {
-    Board copy = temp.copy();
-    copy.do_move(~color, legalMoves.get(i));
+}  // namespace
 
-    next(p, copy, color, plies-1);
+int main(int argc, char **argv) {
+  Options o;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+      return 1;
+    }
+    if (!strcmp(argv[i], "-f")) o.file = argv[++i];
+    else if (!strcmp(argv[i], "-t")) o.threads = max(1, atoi(argv[++i]));
+    else if (!strcmp(argv[i], "-d")) o.depth = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-k")) o.lines = max(1, atoi(argv[++i]));
+    else if (!strcmp(argv[i], "-n")) o.positions = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-p")) o.maxPlies = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-w")) o.margin = atoi(argv[++i]) * EVAL_SCALE_FACTOR;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
   }
-}
 
-int main(int argc, char **argv) {
-  // Read existing book, if any
-  read_file();
   init_eval();
-
-  Player p(BLACK, false, 20);
-  Player p2(WHITE, false, 20);
-  p.set_depths(24, 36);
-  p2.set_depths(24, 36);
-  Board b;
-  // consider black
-  next(p, b, BLACK, 4);
-  // consider white
-  ArrayList lm = b.legal_movelist(BLACK);
-  for (int i = 0; i < 4; i++) {
-    Board copy = b.copy();
-    copy.do_move(BLACK, lm.get(i));
-
-    next(p2, copy, WHITE, 4);
+  // Resume from the existing book, if any
+  Openings book;
+  if (book.read_file(o.file))
+    cerr << "Read " << book.size() << " positions from " << o.file << endl;
+
+  vector<Player *> players;
+  for (int t = 0; t < o.threads; t++) {
+    Player *p = new Player(BLACK, false, 20);
+    p->set_depths(o.depth, 0);
+    p->multiPv = o.lines;
+    // Book positions recur in all orientations
+    p->transpositionTable->set_symmetric(SYMMETRIC_EMPTIES);
+    players.push_back(p);
   }
 
-  write_file();
-  return 0;
-}
+  auto start_time = Clock::now();
+  int added = 0;
+  uint64_t total_nodes = 0;
+  while (added < o.positions) {
+    unordered_map<BookKey, int, BookKeyHash> visited;
+    unordered_map<BookKey, Leaf, BookKeyHash> leaf_map;
+    find_leaves(book, o, Board(), BLACK, 0, 0, visited, leaf_map);
+    if (leaf_map.empty()) {
+      cerr << "No leaves left within the drop-out margin and plies" << endl;
+      break;
+    }
 
-bool read_file() {
-  std::string line;
-  std::ifstream openingbk("newbook.txt");
-
-  if (openingbk.is_open()) {
-    // Discard the first line, which contains the size
-    getline(openingbk, line);
-    while (getline(openingbk, line)) {
-      stringForm.push_back(std::string(line));
-      std::string::size_type sz = 0;
-      Node temp;
-      temp.taken = std::stoull(line, &sz, 0);
-      line = line.substr(sz);
-      temp.black = std::stoull(line, &sz, 0);
-      line = line.substr(sz);
-      int m = std::stoi(line, &sz, 0);
-      temp.move = m;
-      openings.push_back(temp);
+    vector<Leaf> leaves;
+    for (auto it = leaf_map.begin(); it != leaf_map.end(); ++it)
+      leaves.push_back(it->second);
+    sort(leaves.begin(), leaves.end(), [](const Leaf &x, const Leaf &y) {
+      return x.cost < y.cost || (x.cost == y.cost && x.plies < y.plies);
+    });
+    int batch = min((int) leaves.size(), min(2 * o.threads, o.positions - added));
+
+    // Search the batch in parallel
+    vector<AnalysisResult> results(batch);
+    atomic<int> next_index(0);
+    vector<thread> workers;
+    for (int t = 0; t < o.threads; t++) {
+      workers.push_back(thread([&, t]() {
+        Player *p = players[t];
+        for (int i = next_index++; i < batch; i = next_index++) {
+          p->game = leaves[i].b;
+          p->mySide = leaves[i].c;
+          results[i] = p->analyze(o.depth, 0, 0);
+        }
+      }));
+    }
+    for (unsigned int t = 0; t < workers.size(); t++)
+      workers[t].join();
+
+    for (int i = 0; i < batch; i++) {
+      // Symmetric moves lead to the same book position, so keep only the first
+      vector<BookKey> children;
+      for (unsigned int j = 0; j < results[i].lines.size(); j++) {
+        const PVLine &line = results[i].lines[j];
+        Board child = leaves[i].b.copy();
+        child.do_move(leaves[i].c, line.pv[0]);
+        int s;
+        BookKey k = book.key(child, ~leaves[i].c, &s);
+        if (find(children.begin(), children.end(), k) != children.end())
+          continue;
+        children.push_back(k);
+        book.add(leaves[i].b, leaves[i].c, line.pv[0], line.score);
+      }
+      total_nodes += results[i].nodes;
     }
-    openingbk.close();
-    return true;
+    added += batch;
+    // Replace the book file only once the new one is complete
+    if (book.write_file(o.file + ".tmp"))
+      rename((o.file + ".tmp").c_str(), o.file.c_str());
+
+    uint64_t ms = get_time_elapsed(start_time);
+    cerr << "Book: " << book.size() << " positions | added " << added
+         << " | leaves " << leaves.size() << " | cost " << leaves[batch-1].cost
+         << " | " << 1000.0 * added / ms << " positions/s | "
+         << 1000 * total_nodes / ms << " nps" << endl;
   }
-  return false;
-}
 
-void write_file() {
-  // Sort
-  std::sort(stringForm.begin(), stringForm.end());
+  uint64_t ms = get_time_elapsed(start_time);
+  cerr << "Added " << added << " positions in " << ms / 1000.0 << " s ("
+       << 1000.0 * added / ms << " positions/s, " << total_nodes << " nodes, "
+       << 1000 * total_nodes / ms << " nps)" << endl;
 
-  ofstream out;
-  out.open("newbook.txt");
-  out << stringForm.size() << endl;
-  for (unsigned int i = 0; i < stringForm.size(); i++) {
-    out << stringForm[i] << endl;
-  }
-  out.close();
+  for (unsigned int t = 0; t < players.size(); t++)
+    delete players[t];
+  return 0;
 }
@@ -1,4 +1,10 @@
+#include <algorithm>
+#include <atomic>
+#include <fstream>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "bbinit.h"
 #include "endgame.h"
 
@@ -19,7 +25,8 @@ const int STAB_THRESHOLD[40] = {
   64, 64, 64, 64, 64
 };
 
-const int ROOT_SORT_DEPTHS[40] = { 0,
+// Defaults for EndgameConfig
+const int ROOT_SORT_DEPTHS[EndgameConfig::DEPTHS] = { 0,
   0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
   0, 0, 4, 4, 6, 6, 8, 8, 10, 12,
   14, 16, 18, 18, 20, 20, 22, 22, 24, 24,
@@ -27,7 +34,7 @@ const int ROOT_SORT_DEPTHS[40] = { 0,
 };
 
 // Depths for sort searching. Indexed by depth.
-const int ENDGAME_SORT_DEPTHS[40] = { 0,
+const int ENDGAME_SORT_DEPTHS[EndgameConfig::DEPTHS] = { 0,
   0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
   0, 0, 0, 0, 0, 1, 1, 1, 2, 2,
   3, 3, 4, 4, 5, 5, 6, 6, 7, 8,
@@ -36,38 +43,44 @@ const int ENDGAME_SORT_DEPTHS[40] = { 0,
 
 const int END_MEDIUM = 11;
 const int END_SHALLOW = 6;
+// Depths at or below this use the depth-specialized endgame_n<>. Chosen by
+// running testsuites eg 16 with values 3 to 5.
+const int END_UNROLLED = 4;
+static_assert(END_UNROLLED >= 2 && END_UNROLLED < END_SHALLOW, "END_UNROLLED out of range");
+// Sort searches deeper than this are never useful, and would be very slow
+const int MAX_SORT_DEPTH = 40;
 
 const int SCORE_TIMEOUT = 65;
 const int MOVE_FAIL_LOW = -1;
 
-struct EndgameStatistics {
-  uint64_t hashHits, hashCuts;
-  uint64_t hashMoveAttempts, hashMoveCuts;
-  uint64_t firstFailHighs, failHighs;
-  uint64_t stability_cuts, stability_attempts;
-
-  void reset() {
-    hashHits = 0;
-    hashCuts = 0;
-    hashMoveAttempts = 0;
-    hashMoveCuts = 0;
-    firstFailHighs = 0;
-    failHighs = 0;
-    stability_cuts = 0;
-    stability_attempts = 0;
-  }
-};
-
-EndgameStatistics egStats;
+// Counts an event in the stats for a depth. Compiles to nothing unless
+// ENDGAME_STATS is on.
+#if ENDGAME_STATS
+#define COUNT_STAT(depth, counter) (stats.depths[depth].counter++)
+#else
+#define COUNT_STAT(depth, counter) ((void) 0)
+#endif
 
-// 16384 entries
+// The defaults, until resized. The tables have at least 2^10 entries.
+// 2^10 entries * 24 bytes/entry = 24 KB
 EndHash endgameTable(9);
-// 2^23 entries * 20 bytes/entry = 168 MB
+// 2^18 entries * 24 bytes/entry = 6 MB
 EndHash cutTable(18);
-// 2^22 entries * 20 bytes/entry = 84 MB
+// 2^17 entries * 24 bytes/entry = 3 MB
 EndHash allTable(17);
-// 2^16 array slots (2^17 entries) * 64 bytes/slot = 4 MB
+// 2^11 array slots (2^12 entries) * 64 bytes/slot = 128 KB
 Hash transpositionTable(11);
+// Static evaluations for the sort searches
+EvalCache evalCache(EVAL_CACHE_BITS);
+
+// Starts a new generation in the endgame tables. Their entries are exact or
+// bounds on the exact score, so those of earlier solves stay usable, but give
+// way to the entries of this one.
+void new_endhash_search() {
+  endgameTable.new_search();
+  cutTable.new_search();
+  allTable.new_search();
+}
 
 }  // namespace
 
@@ -78,13 +91,44 @@ void resize_endhash(uint32_t pv_bits) {
   transpositionTable.resize(pv_bits + 2);
 }
 
-Endgame::Endgame() {
+void resize_endhash_bytes(uint64_t bytes) {
+  // The proportions of resize_endhash(): 1 entry of the PV table to 512 of
+  // the cut table and 256 of the all table
+  const uint64_t pv = sizeof(EndgameEntry);
+  const uint64_t cut = 512 * sizeof(EndgameEntry);
+  const uint64_t all = 256 * sizeof(EndgameEntry);
+  const uint64_t total = pv + cut + all;
+  endgameTable.resize_bytes(bytes / total * pv);
+  cutTable.resize_bytes(bytes / total * cut);
+  allTable.resize_bytes(bytes / total * all);
+}
+
+void print_endhash_memory(std::ostream &out) {
+  out << "PV " << endgameTable.bytes() / 1024 << " KB | cut "
+      << cutTable.bytes() / 1024 << " KB | all "
+      << allTable.bytes() / 1024 << " KB";
+}
+
+void clear_endhash() {
   endgameTable.clear();
   cutTable.clear();
   allTable.clear();
   transpositionTable.clear();
 }
 
+int endhash_full() {
+  return cutTable.hash_full();
+}
+
+Endgame::Endgame() {
+  threads = 1;
+  stopControl = nullptr;
+  control = nullptr;
+  sortTable = &transpositionTable;
+  // The tables are shared by all solvers, and keep the work of earlier ones
+  new_endhash_search();
+}
+
 int Endgame::solve_endgame(Board &b, Eval* e, Color c, ArrayList &moves, bool is_sorted,
   int depth, int time_limit, int *exact_score) {
   return solve_endgame_with_window(b, e, c, moves, is_sorted, depth, -64, 64,
@@ -117,63 +161,71 @@ int Endgame::solve_wld(Board &b, Eval* e, Color c, ArrayList &moves, bool is_sor
   return best_move;
 }
 
+int Endgame::solve_endgame_sorted(Board &b, Eval* e, Color c, ArrayList &moves, int depth,
+  int sort_score, int time_limit, int *exact_score) {
+  return solve_root(b, e, c, moves, true, &sort_score, depth, -64, 64, time_limit, exact_score);
+}
+
 int Endgame::solve_endgame_with_window(Board &b, Eval* e, Color c, ArrayList &moves, bool is_sorted,
   int depth, int alpha, int beta, int time_limit, int *exact_score) {
+  return solve_root(b, e, c, moves, is_sorted, nullptr, depth, alpha, beta, time_limit,
+    exact_score);
+}
+
+int Endgame::solve_root(Board &b, Eval* e, Color c, ArrayList &moves, bool is_sorted,
+  const int *sort_score, int depth, int alpha, int beta, int time_limit, int *exact_score) {
+  pv.clear();
   // if best move for this position has already been found and stored
-  EndgameEntry *entry = endgameTable.get(b, c);
-  if (entry != nullptr) {
+  EndgameEntry entry;
+  if (endgameTable.get(b, c, &entry)) {
+    pv.push_back(entry.move);
     #if PRINT_SEARCH_INFO
     cerr << "Endgame hashtable hit." << endl;
-    cerr << "Best move: " << print_move(entry->move);
-    cerr << " Score: " << (int) (entry->score) << endl;
+    cerr << "Best move: " << print_move(entry.move);
+    cerr << " Score: " << (int) (entry.score) << endl;
     #endif
     if (exact_score != nullptr)
-      *exact_score = entry->score;
-    return entry->move;
+      *exact_score = entry.score;
+    return entry.move;
   }
 
-  auto start_time = Clock::now();
   #if PRINT_SEARCH_INFO
   uint64_t time_span = 0;
   #endif
 
   nodes = 0;
-  egStats.reset();
-  searchStart = Clock::now();
-  timeout = (uint64_t) time_limit;
+  stats.reset();
+  new_endhash_search();
+  SearchControl solve_control(stopControl);
+  solve_control.start((uint64_t) time_limit);
+  control = &solve_control;
 
   SearchInfo search_info;
-  search_info.time_limit = 0;
-  search_info.tt = &transpositionTable;
+  // Same age as a midgame search of this position, for a shared sortTable
+  search_info.root_age = 64 - depth;
+  search_info.tt = sortTable;
+  search_info.eval_cache = &evalCache;
   search_info.other_heuristic = true;
-  search_info.search_start = searchStart;
 
   int ss_score = 0;
   // Initial sorting of moves
-  if (!is_sorted && depth > 12) {
-    for (int ss_depth = 1; ss_depth <= ROOT_SORT_DEPTHS[depth]; ss_depth++) {
-      int ss_move = pvs_best_move(b, e, c, moves, &ss_score, ss_depth, &search_info);
-      moves.swap(ss_move, 0);
-    }
-
-    #if PRINT_SEARCH_INFO
-    time_span = get_time_elapsed(start_time);
-    cerr << "Sort search: depth " << ROOT_SORT_DEPTHS[depth] << " | " << time_span << " ms | nodes: "
-         << search_info.nodes << " | NPS: " << 1000 * search_info.nodes / time_span << endl;
-    cerr << "PV: " << print_move(moves.get(0));
-    cerr << " Score: " << ss_score / EVAL_SCALE_FACTOR << endl;
-    #endif
+  if (sort_score != nullptr) {
+    ss_score = *sort_score;
+  } else if (!is_sorted && depth > 12) {
+    ss_score = sort_root_moves(b, e, c, moves, depth, &search_info);
     search_info.nodes = 0;
   }
 
-  start_time = Clock::now();
+  #if PRINT_SEARCH_INFO
+  auto start_time = Clock::now();
+  #endif
 
   // Playing with aspiration windows...
   int score;
   int asp_alpha = alpha;
   int asp_beta = beta;
   int best_index = MOVE_FAIL_LOW;
-  if (!is_sorted && depth > 12) {
+  if ((!is_sorted || sort_score != nullptr) && depth > 12) {
     int est_score = ss_score / EVAL_SCALE_FACTOR;
     asp_alpha = max(est_score - 2, alpha);
     asp_beta = min(est_score + 2, beta);
@@ -189,7 +241,10 @@ int Endgame::solve_endgame_with_window(Board &b, Eval* e, Color c, ArrayList &mo
     #if PRINT_SEARCH_INFO
     cerr << "Aspiration search: [" << asp_alpha << ", " << asp_beta << "]" << endl;
     #endif
-    best_index = endgame_aspiration(b, e, c, moves, depth, asp_alpha, asp_beta, score, &search_info);
+    if (threads > 1 && depth > config.endMedium)
+      best_index = endgame_root_parallel(b, e, c, moves, depth, asp_alpha, asp_beta, score, &search_info);
+    else
+      best_index = endgame_aspiration(b, e, c, moves, depth, asp_alpha, asp_beta, score, &search_info);
     // If we got broken out
     if (best_index == MOVE_BROKEN)
       return MOVE_BROKEN;
@@ -222,21 +277,23 @@ int Endgame::solve_endgame_with_window(Board &b, Eval* e, Color c, ArrayList &mo
     best_move = moves.get(0);
   }
 
+  if (best_move != MOVE_FAIL_LOW) {
+    if (alpha == -64 && beta == 64)
+      pv = principal_variation(b, e, c, best_move, score, &search_info);
+    else
+      pv.push_back(best_move);
+  }
+
   nodes += search_info.nodes;
   #if PRINT_SEARCH_INFO
   cerr << "Hashfull: PV=" << endgameTable.hash_full() << " | A="
                           << cutTable.hash_full() << " | B="
                           << allTable.hash_full() << " | Sort="
-                          << transpositionTable.hash_full() << endl;
+                          << sortTable->hash_full() << endl;
 
   time_span = get_time_elapsed(start_time);
   cerr << "Nodes: " << nodes << " | NPS: " << 1000 * nodes / time_span << endl;
 
-  // cerr << "Hash score cut rate: " << egStats.hashCuts << " / " << egStats.hashHits << endl;
-  // cerr << "Hash move cut rate: " << egStats.hashMoveCuts << " / " << egStats.hashMoveAttempts << endl;
-  // cerr << "First fail high rate: " << egStats.firstFailHighs << " / " << egStats.failHighs << endl;
-  // cerr << "Stability cuts: " << egStats.stability_cuts << " / " << egStats.stability_attempts << endl;
-
   cerr << "Time spent (ms): " << time_span << endl;
   cerr << "Best move: ";
   // If we failed low on the bounds we were given, that isn't our business
@@ -244,7 +301,8 @@ int Endgame::solve_endgame_with_window(Board &b, Eval* e, Color c, ArrayList &mo
     cerr << "N/A";
   else
     cerr << print_move(best_move);
-  cerr << " Score: " << score << endl << endl;
+  cerr << " Score: " << score << endl;
+  cerr << "PV: " << print_pv(pv) << endl << endl;
   #endif
 
   if (exact_score != nullptr)
@@ -252,6 +310,98 @@ int Endgame::solve_endgame_with_window(Board &b, Eval* e, Color c, ArrayList &mo
   return best_move;
 }
 
+int Endgame::solve_multi_pv(Board &b, Eval* e, Color c, ArrayList &moves, bool is_sorted, int depth,
+  int k, int time_limit, std::vector<PVLine> &lines) {
+  nodes = 0;
+  stats.reset();
+  new_endhash_search();
+  SearchControl solve_control(stopControl);
+  solve_control.start((uint64_t) time_limit);
+  control = &solve_control;
+
+  SearchInfo search_info;
+  // Same age as a midgame search of this position, for a shared sortTable
+  search_info.root_age = 64 - depth;
+  search_info.tt = sortTable;
+  search_info.eval_cache = &evalCache;
+  search_info.other_heuristic = true;
+
+  if (!is_sorted && depth > 12) {
+    sort_root_moves(b, e, c, moves, depth, &search_info);
+    search_info.nodes = 0;
+  }
+  ArrayList priority = root_priorities(b, e, c, moves, depth, &search_info);
+  for (int i = 0; i < moves.size(); i++)
+    next_move(moves, priority, i);
+
+  // The first top moves are the best lines so far, sorted by score
+  ArrayList scores;
+  int top = 0;
+  for (int i = 0; i < moves.size(); i++) {
+    int m = moves.get(i);
+    Board copy = b.copy();
+    Eval ec = *e;
+    uint64_t mask = copy.get_do_move(c, m);
+    ec.update(c, m, mask);
+    copy.do_move(c, m, mask);
+    nodes++;
+
+    int score;
+    if (top < k)
+      score = -dispatch(copy, &ec, ~c, depth-1, -64, 64, &search_info);
+    else {
+      // Only an exact score better than the k-th best line is needed
+      int alpha = scores.get(k-1);
+      score = -dispatch(copy, &ec, ~c, depth-1, -alpha-1, -alpha, &search_info);
+      if (alpha < score && score != SCORE_TIMEOUT)
+        score = -dispatch(copy, &ec, ~c, depth-1, -64, -alpha, &search_info);
+    }
+    if (score == SCORE_TIMEOUT)
+      return MOVE_BROKEN;
+    scores.add(score);
+
+    if (top == k && score <= scores.get(k-1))
+      continue;
+    // Insert into the best lines, pushing the rest back by one
+    int j = i;
+    while (j > 0 && (j > top || scores.get(j-1) < score)) {
+      moves.swap(j, j-1);
+      scores.swap(j, j-1);
+      j--;
+    }
+    top = std::min(top + 1, k);
+  }
+
+  lines.clear();
+  for (int i = 0; i < top; i++) {
+    lines.push_back(PVLine{scores.get(i),
+      principal_variation(b, e, c, moves.get(i), scores.get(i), &search_info)});
+  }
+  nodes += search_info.nodes;
+  return top;
+}
+
+int Endgame::sort_root_moves(Board &b, Eval* e, Color c, ArrayList &moves, int depth,
+  SearchInfo* search_info) {
+  #if PRINT_SEARCH_INFO
+  auto start_time = Clock::now();
+  #endif
+  int ss_score = 0;
+  for (int ss_depth = 1; ss_depth <= config.rootSortDepths[depth]; ss_depth++) {
+    int ss_move = pvs_best_move(b, e, c, moves, &ss_score, ss_depth, search_info);
+    moves.swap(ss_move, 0);
+  }
+
+  #if PRINT_SEARCH_INFO
+  uint64_t time_span = get_time_elapsed(start_time);
+  cerr << "Sort search: depth " << config.rootSortDepths[depth] << " | " << time_span << " ms | nodes: "
+       << search_info->nodes << " | NPS: " << 1000 * search_info->nodes / time_span << endl;
+  cerr << "PV: " << print_move(moves.get(0));
+  cerr << " Score: " << ss_score / EVAL_SCALE_FACTOR << endl;
+  #endif
+  return ss_score;
+}
+
 int Endgame::endgame_aspiration(Board &b, Eval* e, Color c, ArrayList &moves, int depth,
   int alpha, int beta, int &exact_score, SearchInfo* search_info) {
   int score, best_score = -INFTY;
@@ -259,24 +409,7 @@ int Endgame::endgame_aspiration(Board &b, Eval* e, Color c, ArrayList &moves, in
   int best_index = MOVE_FAIL_LOW;
 
   // Sort moves other than the best move
-  ArrayList priority;
-  priority.add(1 << 25);
-  for (int i = 1; i < moves.size(); i++) {
-    int m = moves.get(i);
-    if (depth > END_MEDIUM) {
-      Board copy = b.copy();
-      Eval ec = *e;
-      uint64_t mask = copy.get_do_move(c, m);
-      ec.update(c, m, mask);
-      copy.do_move(c, m, mask);
-      priority.add(-pvs(copy, &ec, ~c, ENDGAME_SORT_DEPTHS[depth+2], -INFTY, INFTY, false, search_info));
-    } else {
-      int p = SQ_VAL[m];
-      if (!(NEIGHBORS[m] & ~b.occupied()))
-        p += 16;
-      priority.add(p);
-    }
-  }
+  ArrayList priority = root_priorities(b, e, c, moves, depth, search_info);
 
   int i = 0;
   for (int m = next_move(moves, priority, i); m != MOVE_NULL;
@@ -326,90 +459,278 @@ int Endgame::endgame_aspiration(Board &b, Eval* e, Color c, ArrayList &moves, in
   return best_index;
 }
 
-int Endgame::dispatch(Board &b, Eval* e, Color c, int depth, int alpha, int beta, SearchInfo* search_info) {
-  switch (depth) {
-    case 4:
-      return endgame4(b, c, alpha, beta, false);
-    case 3:
-      return endgame3(b, c, alpha, beta, false);
-    case 2: {
-      uint64_t empty = ~b.occupied();
-      int lm1 = bitscan_forward(empty);
-      empty &= empty - 1;
-      int lm2 = bitscan_forward(empty);
-      return endgame2(b, c, alpha, beta, lm1, lm2);
+int Endgame::endgame_root_parallel(Board &b, Eval* e, Color c, ArrayList &moves, int depth,
+  int alpha, int beta, int &exact_score, SearchInfo* search_info) {
+  // Sort all moves up front, since they are handed out to workers in order
+  ArrayList priority = root_priorities(b, e, c, moves, depth, search_info);
+  for (int i = 0; i < moves.size(); i++)
+    next_move(moves, priority, i);
+
+  // Stopped by the first worker to fail high, and whenever the solve is
+  SearchControl cutoff_control(control);
+  std::atomic<int> next_index(0);
+  std::mutex result_lock;
+  int best_score = -INFTY;
+  int best_index = MOVE_FAIL_LOW;
+  bool broken = false;
+
+  auto worker = [&]() {
+    // Copies share the global tables. The constructor, which clears them, is
+    // not run.
+    Endgame solver = *this;
+    solver.nodes = 0;
+    solver.stats.reset();
+    solver.control = &cutoff_control;
+    SearchInfo worker_info = *search_info;
+    worker_info.nodes = 0;
+    worker_info.stack = thread_stack();
+
+    int i;
+    while (!cutoff_control.stopped() && (i = next_index.fetch_add(1)) < moves.size()) {
+      int m = moves.get(i);
+      int root_alpha;
+      {
+        std::lock_guard<std::mutex> lock(result_lock);
+        root_alpha = alpha;
+      }
+
+      Board copy = b.copy();
+      Eval ec = *e;
+      uint64_t mask = copy.get_do_move(c, m);
+      ec.update(c, m, mask);
+      copy.do_move(c, m, mask);
+      solver.nodes++;
+
+      int score;
+      if (i != 0) {
+        score = -solver.dispatch(copy, &ec, ~c, depth-1, -root_alpha-1, -root_alpha, &worker_info);
+        if (root_alpha < score && score < beta)
+          score = -solver.dispatch(copy, &ec, ~c, depth-1, -beta, -root_alpha, &worker_info);
+      }
+      else
+        score = -solver.dispatch(copy, &ec, ~c, depth-1, -beta, -root_alpha, &worker_info);
+
+      std::lock_guard<std::mutex> lock(result_lock);
+      if (score == SCORE_TIMEOUT) {
+        // A stop from another worker's cutoff is not a timeout
+        if (control->stopped())
+          broken = true;
+        cutoff_control.stop();
+        break;
+      }
+      // Proven as good as beta: no need to search the other moves
+      if (score >= beta) {
+        best_score = score;
+        best_index = i;
+        cutoff_control.stop();
+        break;
+      }
+      if (score > best_score)
+        best_score = score;
+      if (alpha < score) {
+        alpha = score;
+        best_index = i;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(result_lock);
+    nodes += solver.nodes;
+    search_info->nodes += worker_info.nodes;
+    #if ENDGAME_STATS
+    stats.add(solver.stats);
+    #endif
+  };
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < std::min(threads, moves.size()); t++)
+    workers.push_back(std::thread(worker));
+  for (unsigned int t = 0; t < workers.size(); t++)
+    workers[t].join();
+
+  if (broken && best_score < beta) {
+    #if PRINT_SEARCH_INFO
+    cerr << "Breaking out of endgame solver." << endl;
+    #endif
+    // If we have already found a winning move, mind as well take it.
+    if (best_index != MOVE_FAIL_LOW && alpha > 0) {
+      exact_score = alpha;
+      return best_index;
+    }
+    return MOVE_BROKEN;
+  }
+
+  exact_score = best_score;
+  return best_index;
+}
+
+ArrayList Endgame::root_priorities(Board &b, Eval* e, Color c, ArrayList &moves, int depth,
+  SearchInfo* search_info) {
+  // The first move is kept first
+  ArrayList priority;
+  priority.add(1 << 25);
+  for (int i = 1; i < moves.size(); i++) {
+    int m = moves.get(i);
+    if (depth > config.endMedium) {
+      Board copy = b.copy();
+      Eval ec = *e;
+      uint64_t mask = copy.get_do_move(c, m);
+      ec.update(c, m, mask);
+      copy.do_move(c, m, mask);
+      priority.add(-pvs(copy, &ec, ~c, config.sortDepths[depth+2], -INFTY, INFTY, false, search_info));
+    } else {
+      int p = SQ_VAL[m];
+      if (!(NEIGHBORS[m] & ~b.occupied()))
+        p += 16;
+      priority.add(p);
+    }
+  }
+  return priority;
+}
+
+std::vector<int> Endgame::principal_variation(Board &b, Eval* e, Color c, int move, int score,
+  SearchInfo* search_info) {
+  std::vector<int> line;
+  line.push_back(move);
+  Board pos = b.copy();
+  Eval pos_eval = *e;
+  uint64_t mask = pos.get_do_move(c, move);
+  pos_eval.update(c, move, mask);
+  pos.do_move(c, move, mask);
+  c = ~c;
+  score = -score;
+
+  while (true) {
+    uint64_t legal = pos.legal_moves(c);
+    if (!legal) {
+      if (!pos.legal_moves(~c))
+        break;
+      line.push_back(MOVE_NULL);
+      c = ~c;
+      score = -score;
+      continue;
+    }
+
+    int next = MOVE_NULL;
+    EndgameEntry entry;
+    if (endgameTable.get(pos, c, &entry) && entry.score == score
+     && entry.move < 64 && (legal & SQ_TO_BIT[entry.move])) {
+      next = entry.move;
+    }
+    int depth = pos.count_empty();
+    MoveList moves(legal);
+    for (int i = 0; next == MOVE_NULL && i < moves.size(); i++) {
+      int m = moves.move(i);
+      Board copy = pos.copy();
+      Eval ec = pos_eval;
+      mask = copy.get_do_move(c, m);
+      ec.update(c, m, mask);
+      copy.do_move(c, m, mask);
+      nodes++;
+      int child = -dispatch(copy, &ec, ~c, depth-1, -score-1, -score+1, search_info);
+      // Out of time: return what we have so far
+      if (child == SCORE_TIMEOUT)
+        return line;
+      if (child == score)
+        next = m;
     }
-    default:
-      return endgame_deep(b, e, c, depth, alpha, beta, false, search_info);
+    // Only if the given score was not exact
+    if (next == MOVE_NULL)
+      break;
+
+    line.push_back(next);
+    mask = pos.get_do_move(c, next);
+    pos_eval.update(c, next, mask);
+    pos.do_move(c, next, mask);
+    c = ~c;
+    score = -score;
   }
+
+  if (line.back() == MOVE_NULL)
+    line.pop_back();
+  return line;
+}
+
+int Endgame::dispatch(Board &b, Eval* e, Color c, int depth, int alpha, int beta, SearchInfo* search_info) {
+  if (depth >= 2 && depth <= END_UNROLLED)
+    return endgame_unrolled<END_UNROLLED>(b, c, depth, alpha, beta, false);
+  return endgame_deep(b, e, c, depth, alpha, beta, false, search_info);
 }
 
 int Endgame::endgame_deep(Board &b, Eval* e, Color c, int depth, int alpha, int beta, bool passed_last, SearchInfo* search_info) {
-  if (depth <= END_MEDIUM)
+  if (depth <= config.endMedium)
     return endgame_medium(b, c, depth, alpha, beta, passed_last);
+  COUNT_STAT(depth, nodes);
 
   int score, best_score = -INFTY;
   int prev_alpha = alpha;
   bool is_pv_node = (alpha != beta - 1);
 
   // play best move, if recorded
-  EndgameEntry *exact_entry = endgameTable.get(b, c);
-  if (exact_entry != nullptr) {
-    return exact_entry->score;
+  COUNT_STAT(depth, hashProbes);
+  EndgameEntry exact_entry;
+  if (endgameTable.get(b, c, &exact_entry)) {
+    COUNT_STAT(depth, hashHits);
+    COUNT_STAT(depth, hashCuts);
+    return exact_entry.score;
   }
 
   // Stability cutoff: if the current position is hopeless compared to a
   // known lower bound, then we need not waste time searching it.
   #if USE_STABILITY
   if (alpha >= STAB_THRESHOLD[depth]) {
-    egStats.stability_attempts++;
+    COUNT_STAT(depth, stabilityAttempts);
     score = 64 - 2*b.count_stability(~c);
     if (score <= alpha) {
-      egStats.stability_cuts++;
+      COUNT_STAT(depth, stabilityCuts);
       return score;
     }
   }
   #endif
 
-  EndgameEntry *all_entry = allTable.get(b, c);
-  if (all_entry != nullptr) {
-    if (all_entry->score <= alpha)
-      return all_entry->score;
-    if (beta > all_entry->score)
-      beta = all_entry->score;
+  COUNT_STAT(depth, hashProbes);
+  EndgameEntry all_entry;
+  if (allTable.get(b, c, &all_entry)) {
+    COUNT_STAT(depth, hashHits);
+    if (all_entry.score <= alpha) {
+      COUNT_STAT(depth, hashCuts);
+      return all_entry.score;
+    }
+    if (beta > all_entry.score)
+      beta = all_entry.score;
   }
 
   // attempt cut node cutoff, using saved alpha
   int hash_move = MOVE_NULL;
-  EndgameEntry *cut_entry = cutTable.get(b, c);
-  if (cut_entry != nullptr) {
-    egStats.hashHits++;
-    if (cut_entry->score >= beta) {
-      egStats.hashCuts++;
-      return cut_entry->score;
+  COUNT_STAT(depth, hashProbes);
+  EndgameEntry cut_entry;
+  if (cutTable.get(b, c, &cut_entry)) {
+    COUNT_STAT(depth, hashHits);
+    if (cut_entry.score >= beta) {
+      COUNT_STAT(depth, hashCuts);
+      return cut_entry.score;
     }
     // Fail high is lower bound on score so this is valid
-    if (alpha < cut_entry->score)
-      alpha = cut_entry->score;
-    hash_move = cut_entry->move;
+    if (alpha < cut_entry.score)
+      alpha = cut_entry.score;
+    hash_move = cut_entry.move;
 
     // Try the move for a cutoff before move generation
-    egStats.hashMoveAttempts++;
-    Board copy = b.copy();
-    Eval ec = *e;
-    uint64_t mask = copy.get_do_move(c, hash_move);
-    ec.update(c, hash_move, mask);
-    copy.do_move(c, hash_move, mask);
+    COUNT_STAT(depth, hashMoveAttempts);
+    SearchFrame &child = search_info->play(b, e, c, hash_move);
     nodes++;
 
-    score = -endgame_deep(copy, &ec, ~c, depth-1, -beta, -alpha, false, search_info);
+    search_info->ply++;
+    score = -endgame_deep(child.board, &child.eval, ~c, depth-1, -beta, -alpha, false, search_info);
+    search_info->ply--;
 
     // If we received a timeout signal, propagate it upwards
     if (score == SCORE_TIMEOUT)
       return -SCORE_TIMEOUT;
 
     if (score >= beta) {
-      egStats.hashMoveCuts++;
+      COUNT_STAT(depth, hashMoveCuts);
+      COUNT_STAT(depth, cuts);
+      COUNT_STAT(depth, firstMoveCuts);
       return score;
     }
     if (score > best_score) {
@@ -420,8 +741,8 @@ int Endgame::endgame_deep(Board &b, Eval* e, Color c, int depth, int alpha, int
     }
   }
 
-  ArrayList legal_moves = b.legal_movelist(c);
-  if (legal_moves.size() <= 0) {
+  uint64_t legal = b.legal_moves(c);
+  if (!legal) {
     if (passed_last) {
       return (2 * b.count(c) - 64 + depth);
     }
@@ -437,94 +758,83 @@ int Endgame::endgame_deep(Board &b, Eval* e, Color c, int depth, int alpha, int
   // Get a best move from previous sort searches if available
   int ss_move = MOVE_NULL;
   if (is_pv_node) {
-    HashEntry *entry = transpositionTable.get(b, c);
-    if (entry != nullptr) {
-      if (entry->nodeType == PV_NODE
-       && entry->depth >= ENDGAME_SORT_DEPTHS[depth+2]) {
-        ss_move = entry->move;
+    HashEntry entry;
+    if (sortTable->get(b, c, &entry)) {
+      if (entry.nodeType == PV_NODE
+       && entry.depth >= config.sortDepths[depth+2]) {
+        ss_move = entry.move;
       }
     }
   }
 
-  ArrayList priority;
+  MoveList &moves = search_info->stack[search_info->ply].moves;
+  moves = MoveList(legal);
   // Do better move ordering for PV nodes where alpha != beta - 1
   if (is_pv_node) {
-    for (int i = 0; i < legal_moves.size(); i++) {
-      int m = legal_moves.get(i);
-      Board copy = b.copy();
-      uint64_t mask = copy.get_do_move(c, m);
-      copy.do_move(c, m, mask);
-
+    for (int i = 0; i < moves.size(); i++) {
+      int m = moves.move(i);
       if (m == hash_move) {
-        priority.add(1 << 25);
+        moves.set_score(i, 1 << 23);
       } else if (m == ss_move) {
-        priority.add(1 << 24);
+        moves.set_score(i, 1 << 22);
       } else {
-        Eval ec = *e;
-        ec.update(c, m, mask);
-        priority.add(-pvs(copy, &ec, ~c, ENDGAME_SORT_DEPTHS[depth+2], -INFTY, INFTY, passed_last, search_info));
+        SearchFrame &child = search_info->play(b, e, c, m);
+        search_info->ply++;
+        moves.set_score(i, -pvs(child.board, &child.eval, ~c, config.sortDepths[depth+2], -INFTY, INFTY, passed_last, search_info));
+        search_info->ply--;
       }
     }
   }
   // Otherwise, we focus more on fastest first for a cheaper fail-high
   else {
-    for (int i = 0; i < legal_moves.size(); i++) {
-      int m = legal_moves.get(i);
-      Board copy = b.copy();
-      uint64_t mask = copy.get_do_move(c, m);
-      copy.do_move(c, m, mask);
-
+    for (int i = 0; i < moves.size(); i++) {
+      int m = moves.move(i);
       if (m == hash_move) {
-        priority.add(1 << 25);
+        moves.set_score(i, 1 << 23);
       } else {
-        int p = SQ_VAL[m] - 1800 * copy.count_legal_moves(~c) - 256 * stability(copy, ~c);
-        Eval ec = *e;
-        ec.update(c, m, mask);
+        SearchFrame &child = search_info->play(b, e, c, m);
+        int p = SQ_VAL[m] - 1800 * child.board.count_legal_moves(~c) - 256 * stability(child.board, ~c);
+        search_info->ply++;
         // Slowly phase in the sort search relative to fastest first
-        if (ENDGAME_SORT_DEPTHS[depth] == 0)
-          p -= pvs(copy, &ec, ~c, ENDGAME_SORT_DEPTHS[depth], -INFTY, INFTY, passed_last, search_info) >> 1;
+        if (config.sortDepths[depth] == 0)
+          p -= pvs(child.board, &child.eval, ~c, config.sortDepths[depth], -INFTY, INFTY, passed_last, search_info) >> 1;
         else
-          p -= pvs(copy, &ec, ~c, ENDGAME_SORT_DEPTHS[depth], -INFTY, INFTY, passed_last, search_info);
-        priority.add(p);
+          p -= pvs(child.board, &child.eval, ~c, config.sortDepths[depth], -INFTY, INFTY, passed_last, search_info);
+        search_info->ply--;
+        moves.set_score(i, p);
       }
     }
   }
 
   int to_hash = MOVE_NULL;
   int i = 0;
-  for (int m = next_move(legal_moves, priority, i); m != MOVE_NULL;
-           m = next_move(legal_moves, priority, ++i)) {
-    // Check for a timeout
-    if (depth >= 15) {
-      uint64_t time_span = get_time_elapsed(searchStart);
-      if (time_span > timeout)
-        return -SCORE_TIMEOUT;
-    }
+  for (int m = moves.next(i); m != MOVE_NULL; m = moves.next(++i)) {
+    // Check for a timeout or a stop from another thread
+    if (control->stopped())
+      return -SCORE_TIMEOUT;
     // We already tried the hash move
     if (m == hash_move)
       continue;
-    Board copy = b.copy();
-    Eval ec = *e;
-    uint64_t mask = copy.get_do_move(c, m);
-    ec.update(c, m, mask);
-    copy.do_move(c, m, mask);
+    SearchFrame &child = search_info->play(b, e, c, m);
     nodes++;
 
+    search_info->ply++;
     if (i != 0) {
-      score = -endgame_deep(copy, &ec, ~c, depth-1, -alpha-1, -alpha, false, search_info);
+      score = -endgame_deep(child.board, &child.eval, ~c, depth-1, -alpha-1, -alpha, false, search_info);
       if (alpha < score && score < beta)
-        score = -endgame_deep(copy, &ec, ~c, depth-1, -beta, -alpha, false, search_info);
+        score = -endgame_deep(child.board, &child.eval, ~c, depth-1, -beta, -alpha, false, search_info);
     }
     else
-      score = -endgame_deep(copy, &ec, ~c, depth-1, -beta, -alpha, false, search_info);
+      score = -endgame_deep(child.board, &child.eval, ~c, depth-1, -beta, -alpha, false, search_info);
+    search_info->ply--;
 
     // If we received a timeout signal, propagate it upwards
     if (score == SCORE_TIMEOUT)
       return -SCORE_TIMEOUT;
     if (score >= beta) {
-      egStats.failHighs++;
+      COUNT_STAT(depth, cuts);
       if (i == 0)
-        egStats.firstFailHighs++;
+        COUNT_STAT(depth, firstMoveCuts);
       cutTable.add(b, c, score, m, depth);
       return score;
     }
@@ -547,55 +857,64 @@ int Endgame::endgame_deep(Board &b, Eval* e, Color c, int depth, int alpha, int
 }
 
 int Endgame::endgame_medium(Board &b, Color c, int depth, int alpha, int beta, bool passed_last) {
-  if (depth <= END_SHALLOW)
+  if (depth <= config.endShallow)
     return endgame_shallow(b, c, depth, alpha, beta, passed_last);
+  COUNT_STAT(depth, nodes);
 
   int score, best_score = -INFTY;
   int prev_alpha = alpha;
 
   // play best move, if recorded
-  EndgameEntry *exact_entry = endgameTable.get(b, c);
-  if (exact_entry != nullptr) {
-    return exact_entry->score;
+  COUNT_STAT(depth, hashProbes);
+  EndgameEntry exact_entry;
+  if (endgameTable.get(b, c, &exact_entry)) {
+    COUNT_STAT(depth, hashHits);
+    COUNT_STAT(depth, hashCuts);
+    return exact_entry.score;
   }
 
   // Stability cutoff: if the current position is hopeless compared to a
   // known lower bound, then we need not waste time searching it.
   #if USE_STABILITY
   if (alpha >= STAB_THRESHOLD[depth]) {
-    egStats.stability_attempts++;
+    COUNT_STAT(depth, stabilityAttempts);
     score = 64 - 2*b.count_stability(~c);
     if (score <= alpha) {
-      egStats.stability_cuts++;
+      COUNT_STAT(depth, stabilityCuts);
       return score;
     }
   }
   #endif
 
-  EndgameEntry *all_entry = allTable.get(b, c);
-  if (all_entry != nullptr) {
-    if (all_entry->score <= alpha)
-      return all_entry->score;
-    if (beta > all_entry->score)
-      beta = all_entry->score;
+  COUNT_STAT(depth, hashProbes);
+  EndgameEntry all_entry;
+  if (allTable.get(b, c, &all_entry)) {
+    COUNT_STAT(depth, hashHits);
+    if (all_entry.score <= alpha) {
+      COUNT_STAT(depth, hashCuts);
+      return all_entry.score;
+    }
+    if (beta > all_entry.score)
+      beta = all_entry.score;
   }
 
   // attempt cut node cutoff, using saved alpha
   int hash_move = MOVE_NULL;
-  EndgameEntry *cut_entry = cutTable.get(b, c);
-  if (cut_entry != nullptr) {
-    egStats.hashHits++;
-    if (cut_entry->score >= beta) {
-      egStats.hashCuts++;
-      return cut_entry->score;
+  COUNT_STAT(depth, hashProbes);
+  EndgameEntry cut_entry;
+  if (cutTable.get(b, c, &cut_entry)) {
+    COUNT_STAT(depth, hashHits);
+    if (cut_entry.score >= beta) {
+      COUNT_STAT(depth, hashCuts);
+      return cut_entry.score;
     }
     // Fail high is lower bound on score so this is valid
-    if (alpha < cut_entry->score)
-      alpha = cut_entry->score;
-    hash_move = cut_entry->move;
+    if (alpha < cut_entry.score)
+      alpha = cut_entry.score;
+    hash_move = cut_entry.move;
 
     // Try the move for a cutoff before move generation
-    egStats.hashMoveAttempts++;
+    COUNT_STAT(depth, hashMoveAttempts);
     Board copy = b.copy();
     copy.do_move(c, hash_move);
     nodes++;
@@ -603,7 +922,9 @@ int Endgame::endgame_medium(Board &b, Color c, int depth, int alpha, int beta, b
     score = -endgame_medium(copy, ~c, depth-1, -beta, -alpha, false);
 
     if (score >= beta) {
-      egStats.hashMoveCuts++;
+      COUNT_STAT(depth, hashMoveCuts);
+      COUNT_STAT(depth, cuts);
+      COUNT_STAT(depth, firstMoveCuts);
       return score;
     }
     if (score > best_score) {
@@ -623,32 +944,28 @@ int Endgame::endgame_medium(Board &b, Color c, int depth, int alpha, int beta, b
     return -endgame_medium(b, ~c, depth, -beta, -alpha, true);
   }
 
-  // Create an array of moves and scores using SIMD
-  int moves[END_MEDIUM];
-  int n = 0;
+  // Order by piece square tables, fastest first, and hole parity
+  MoveList moves;
   uint64_t empty = ~b.occupied();
   while (legal) {
     int m = bitscan_forward(legal);
     legal &= legal - 1;
 
     if (m == hash_move) {
-      moves[n] = (1 << 25) + m;
+      moves.add(m, 1 << 18);
     } else {
       Board copy = b.copy();
       copy.do_move(c, m);
-      int p = m + 128 * SQ_VAL[m] - 4096 * copy.count_legal_moves(~c);
+      int p = SQ_VAL[m] - 32 * copy.count_legal_moves(~c);
       if (!(NEIGHBORS[m] & empty))
-        p += 2048;
-      moves[n] = p;
+        p += 16;
+      moves.add(m, p);
     }
-    n++;
   }
 
   int to_hash = MOVE_NULL;
   int i = 0;
-  for (int move_score = next_move_shallow(moves, n, i); move_score != MOVE_NULL;
-           move_score = next_move_shallow(moves, n, ++i)) {
-    int m = move_score & 127;
+  for (int m = moves.next(i); m != MOVE_NULL; m = moves.next(++i)) {
     // We already tried the hash move
     if (m == hash_move)
       continue;
@@ -665,6 +982,9 @@ int Endgame::endgame_medium(Board &b, Color c, int depth, int alpha, int beta, b
       score = -endgame_medium(copy, ~c, depth-1, -beta, -alpha, false);
 
     if (score >= beta) {
+      COUNT_STAT(depth, cuts);
+      if (i == 0)
+        COUNT_STAT(depth, firstMoveCuts);
       cutTable.add(b, c, score, m, depth);
       return score;
     }
@@ -687,17 +1007,18 @@ int Endgame::endgame_medium(Board &b, Color c, int depth, int alpha, int beta, b
 }
 
 int Endgame::endgame_shallow(Board &b, Color c, int depth, int alpha, int beta, bool passed_last) {
-  if (depth == 4)
-    return endgame4(b, c, alpha, beta, passed_last);
+  if (depth == END_UNROLLED)
+    return endgame_unrolled<END_UNROLLED>(b, c, depth, alpha, beta, passed_last);
+  COUNT_STAT(depth, nodes);
 
   int score, best_score = -INFTY;
 
   #if USE_STABILITY
   if (alpha >= STAB_THRESHOLD[depth]) {
-    egStats.stability_attempts++;
+    COUNT_STAT(depth, stabilityAttempts);
     score = 64 - 2 * b.count_stability(~c);
     if (score <= alpha) {
-      egStats.stability_cuts++;
+      COUNT_STAT(depth, stabilityCuts);
       return score;
     }
   }
@@ -711,34 +1032,34 @@ int Endgame::endgame_shallow(Board &b, Color c, int depth, int alpha, int beta,
     return -endgame_shallow(b, ~c, depth, -beta, -alpha, true);
   }
 
-  // Create an array of moves and scores using SIMD
-  int moves[END_SHALLOW];
-  int n = 0;
+  MoveList moves;
   uint64_t empty = ~b.occupied();
   while (legal) {
     int m = bitscan_forward(legal);
     legal &= legal-1;
 
     // Sort by piece square tables and hole parity
-    int p = 128 * SQ_VAL[m] + m;
+    int p = SQ_VAL[m];
     if (!(NEIGHBORS[m] & empty))
-      p += 8192;
-    moves[n] = p;
-    n++;
+      p += 64;
+    moves.add(m, p);
   }
 
   // search all moves
   int i = 0;
-  for (int move = next_move_shallow(moves, n, i); move != MOVE_NULL;
-           move = next_move_shallow(moves, n, ++i)) {
+  for (int m = moves.next(i); m != MOVE_NULL; m = moves.next(++i)) {
     Board copy = b.copy();
-    copy.do_move(c, move & 127);
+    copy.do_move(c, m);
     nodes++;
 
     score = -endgame_shallow(copy, ~c, depth-1, -beta, -alpha, false);
 
-    if (score >= beta)
+    if (score >= beta) {
+      COUNT_STAT(depth, cuts);
+      if (i == 0)
+        COUNT_STAT(depth, firstMoveCuts);
       return score;
+    }
     if (score > best_score) {
       best_score = score;
       if (alpha < score)
@@ -749,65 +1070,55 @@ int Endgame::endgame_shallow(Board &b, Color c, int depth, int alpha, int beta,
   return best_score;
 }
 
-int Endgame::endgame4(Board &b, Color c, int alpha, int beta, bool passed_last) {
+// Declared before the generic version so that endgame_n<3> calls the
+// hand-unrolled endgame2.
+template <>
+int Endgame::endgame_n<2>(Board &b, Color c, int alpha, int beta, bool passed_last, const int *empties) {
+  return endgame2(b, c, alpha, beta, empties[0], empties[1]);
+}
+
+template <int D>
+int Endgame::endgame_n(Board &b, Color c, int alpha, int beta, bool passed_last, const int *empties) {
+  COUNT_STAT(D, nodes);
   int score = -INFTY, best_score = -INFTY;
-  int legal_moves[4];
   uint64_t empty = ~b.occupied();
 
-  // At 4 squares remaining, try each individual square as a potential legal move.
-  uint64_t mask = empty;
-  legal_moves[0] = bitscan_forward(mask);
-  mask &= mask-1;
-  legal_moves[1] = bitscan_forward(mask);
-  mask &= mask-1;
-  legal_moves[2] = bitscan_forward(mask);
-  mask &= mask-1;
-  legal_moves[3] = bitscan_forward(mask);
-
-  // Sort holes by parity
-  if (NEIGHBORS[legal_moves[0]] & empty) {
-    if (!(NEIGHBORS[legal_moves[1]] & empty)) {
-      int temp = legal_moves[0];
-      legal_moves[0] = legal_moves[1];
-      legal_moves[1] = legal_moves[3];
-      legal_moves[3] = temp;
-    } else if (!(NEIGHBORS[legal_moves[2]] & empty)) {
-      int temp = legal_moves[0];
-      legal_moves[0] = legal_moves[2];
-      legal_moves[2] = temp;
-      temp = legal_moves[1];
-      legal_moves[1] = legal_moves[3];
-      legal_moves[3] = temp;
-    } else {
-      int temp = legal_moves[0];
-      legal_moves[0] = legal_moves[3];
-      legal_moves[3] = temp;
-    }
-  } else if (NEIGHBORS[legal_moves[1]] & empty) {
-    if (!(NEIGHBORS[legal_moves[2]] & empty)) {
-      int temp = legal_moves[1];
-      legal_moves[1] = legal_moves[2];
-      legal_moves[2] = temp;
-    } else {
-      int temp = legal_moves[1];
-      legal_moves[1] = legal_moves[3];
-      legal_moves[3] = temp;
-    }
+  // Sort holes by parity: squares with no empty neighbors are tried first.
+  int legal_moves[D];
+  int n = 0;
+  for (int i = 0; i < D; i++) {
+    if (!(NEIGHBORS[empties[i]] & empty))
+      legal_moves[n++] = empties[i];
+  }
+  for (int i = 0; i < D; i++) {
+    if (NEIGHBORS[empties[i]] & empty)
+      legal_moves[n++] = empties[i];
   }
 
   uint64_t opp = b.get_bits(~c);
-  for (int i = 0; i < 4; i++) {
+  for (int i = 0; i < D; i++) {
     int m = legal_moves[i];
     uint64_t change_mask;
     if ((opp & NEIGHBORS[m]) && (change_mask = b.get_do_move(c, m))) {
+      // The remaining empty squares, passed down so they are not rescanned
+      int child_empties[D-1];
+      for (int j = 0, k = 0; j < D; j++) {
+        if (j != i)
+          child_empties[k++] = legal_moves[j];
+      }
+
       b.do_move(c, m, change_mask);
       nodes++;
 
-      score = -endgame3(b, ~c, -beta, -alpha, false);
+      score = -endgame_n<D-1>(b, ~c, -beta, -alpha, false, child_empties);
 
       b.undo_move(c, m, change_mask);
-      if (score >= beta)
+      if (score >= beta) {
+        COUNT_STAT(D, cuts);
+        if (best_score == -INFTY)
+          COUNT_STAT(D, firstMoveCuts);
         return score;
+      }
       if (score > best_score) {
         best_score = score;
         if (alpha < score)
@@ -818,101 +1129,41 @@ int Endgame::endgame4(Board &b, Color c, int alpha, int beta, bool passed_last)
 
   if (score == -INFTY) {
     if (passed_last)
-      return (2 * b.count(c) - 60);
+      return (2 * b.count(c) - 64 + D);
 
-    return -endgame4(b, ~c, -beta, -alpha, true);
+    return -endgame_n<D>(b, ~c, -beta, -alpha, true, legal_moves);
   }
 
   return best_score;
 }
 
-int Endgame::endgame3(Board &b, Color c, int alpha, int beta, bool passed_last) {
-  int score = -INFTY, best_score = -INFTY;
-  int legal_moves[3];
+// The last level, which callers only reach with depth 2, ends the recursion
+template <>
+int Endgame::endgame_unrolled<2>(Board &b, Color c, int depth, int alpha, int beta, bool passed_last) {
   uint64_t empty = ~b.occupied();
+  int empties[2];
+  empties[0] = bitscan_forward(empty);
+  empty &= empty - 1;
+  empties[1] = bitscan_forward(empty);
+  return endgame_n<2>(b, c, alpha, beta, passed_last, empties);
+}
 
-  uint64_t mask = empty;
-  legal_moves[0] = bitscan_forward(mask);
-  mask &= mask-1;
-  legal_moves[1] = bitscan_forward(mask);
-  mask &= mask-1;
-  legal_moves[2] = bitscan_forward(mask);
-
-  // Sort holes by parity
-  if (NEIGHBORS[legal_moves[0]] & empty) {
-    if (!(NEIGHBORS[legal_moves[1]] & empty)) {
-      int temp = legal_moves[0];
-      legal_moves[0] = legal_moves[1];
-      legal_moves[1] = temp;
-    } else {
-      int temp = legal_moves[0];
-      legal_moves[0] = legal_moves[2];
-      legal_moves[2] = temp;
-    }
-  }
-
-  uint64_t opp = b.get_bits(~c);
-
-  int m = legal_moves[0];
-  uint64_t change_mask;
-  if ((opp & NEIGHBORS[m]) && (change_mask = b.get_do_move(c, m))) {
-    b.do_move(c, m, change_mask);
-    nodes++;
-    score = -endgame2(b, ~c, -beta, -alpha, legal_moves[1], legal_moves[2]);
-    b.undo_move(c, m, change_mask);
-
-    if (score >= beta)
-      return score;
-    if (score > best_score) {
-      best_score = score;
-      if (alpha < score)
-        alpha = score;
-    }
-  }
-
-  m = legal_moves[1];
-  if ((opp & NEIGHBORS[m]) && (change_mask = b.get_do_move(c, m))) {
-    b.do_move(c, m, change_mask);
-    nodes++;
-    score = -endgame2(b, ~c, -beta, -alpha, legal_moves[0], legal_moves[2]);
-    b.undo_move(c, m, change_mask);
-
-    if (score >= beta)
-      return score;
-    if (score > best_score) {
-      best_score = score;
-      if (alpha < score)
-        alpha = score;
-    }
-  }
-
-  m = legal_moves[2];
-  if ((opp & NEIGHBORS[m]) && (change_mask = b.get_do_move(c, m))) {
-    b.do_move(c, m, change_mask);
-    nodes++;
-    score = -endgame2(b, ~c, -beta, -alpha, legal_moves[0], legal_moves[1]);
-    b.undo_move(c, m, change_mask);
-
-    if (score >= beta)
-      return score;
-    if (score > best_score) {
-      best_score = score;
-      if (alpha < score)
-        alpha = score;
+template <int D>
+int Endgame::endgame_unrolled(Board &b, Color c, int depth, int alpha, int beta, bool passed_last) {
+  if (depth == D) {
+    int empties[D];
+    uint64_t empty = ~b.occupied();
+    for (int i = 0; i < D; i++) {
+      empties[i] = bitscan_forward(empty);
+      empty &= empty - 1;
     }
+    return endgame_n<D>(b, c, alpha, beta, passed_last, empties);
   }
-
-  if (score == -INFTY) {
-    if (passed_last)
-      return (2 * b.count(c) - 61);
-
-    return -endgame3(b, ~c, -beta, -alpha, true);
-  }
-
-  return best_score;
+  return endgame_unrolled<D-1>(b, c, depth, alpha, beta, passed_last);
 }
 
 int Endgame::endgame2(Board &b, Color c, int alpha, int beta, int lm1, int lm2) {
+  COUNT_STAT(2, nodes);
   int score = -INFTY, best_score = -INFTY;
   uint64_t opp = b.get_bits(~c);
   uint64_t change_mask;
@@ -923,8 +1174,11 @@ int Endgame::endgame2(Board &b, Color c, int alpha, int beta, int lm1, int lm2)
     score = -endgame1(b, ~c, -beta, lm2);
     b.undo_move(c, lm1, change_mask);
 
-    if (score >= beta)
+    if (score >= beta) {
+      COUNT_STAT(2, cuts);
+      COUNT_STAT(2, firstMoveCuts);
       return score;
+    }
     if (score > best_score)
       best_score = score;
   }
@@ -935,8 +1189,12 @@ int Endgame::endgame2(Board &b, Color c, int alpha, int beta, int lm1, int lm2)
     score = -endgame1(b, ~c, -beta, lm1);
     b.undo_move(c, lm2, change_mask);
 
-    if (score >= beta)
+    if (score >= beta) {
+      COUNT_STAT(2, cuts);
+      if (best_score == -INFTY)
+        COUNT_STAT(2, firstMoveCuts);
       return score;
+    }
     if (score > best_score)
       best_score = score;
   }
@@ -979,22 +1237,23 @@ int Endgame::endgame2(Board &b, Color c, int alpha, int beta, int lm1, int lm2)
 }
 
 int Endgame::endgame1(Board &b, Color c, int alpha, int legal_move) {
+  COUNT_STAT(1, nodes);
   // Get a stand pat score
   int score = 2 * b.count(c) - 63;
 
-  uint64_t change_mask = b.get_do_move(c, legal_move);
+  int flips = b.count_last_flips(c, legal_move);
   nodes++;
   // If the player "c" can move, calculate final score
-  if (change_mask) {
-    score += 2 * count_bits(change_mask) + 1;
+  if (flips) {
+    score += 2 * flips + 1;
   }
   // Otherwise, it is the opponent's move. If the opponent can stand pat,
   // we don't need to calculate the final score.
   else if (score >= alpha) {
-    uint64_t other_mask = b.get_do_move(~c, legal_move);
+    flips = b.count_last_flips(~c, legal_move);
     nodes++;
-    if (other_mask) {
-      score -= 2 * count_bits(other_mask) + 1;
+    if (flips) {
+      score -= 2 * flips + 1;
     }
   }
 
@@ -1003,23 +1262,160 @@ int Endgame::endgame1(Board &b, Color c, int alpha, int legal_move) {
 
 //--------------------------------Utilities-------------------------------------
 
-// Retrieves the next move with the highest score, starting from index using a
-// partial selection sort. This way, the entire list does not have to be sorted
-// if an early cutoff occurs.
-int Endgame::next_move_shallow(int *moves, int size, int index) {
-  if (index >= size)
-    return MOVE_NULL;
-  // Find the index of the next best move/score
-  int best_index = index;
-  for (int i = index + 1; i < size; i++) {
-    if (moves[i] > moves[best_index]) {
-      best_index = i;
+EndgameConfig::EndgameConfig() {
+  endMedium = END_MEDIUM;
+  endShallow = END_SHALLOW;
+  for (int d = 0; d < DEPTHS; d++) {
+    sortDepths[d] = ENDGAME_SORT_DEPTHS[d];
+    rootSortDepths[d] = ROOT_SORT_DEPTHS[d];
+  }
+  costEmpties = 0;
+  costNodes = 0;
+  costEbf = 0;
+  costNps = 0;
+}
+
+bool EndgameConfig::valid() {
+  if (endShallow <= END_UNROLLED || endMedium < endShallow || endMedium > MAX_END_MEDIUM)
+    return false;
+  for (int d = 0; d < DEPTHS; d++) {
+    if (sortDepths[d] < 0 || sortDepths[d] > MAX_SORT_DEPTH
+     || rootSortDepths[d] < 0 || rootSortDepths[d] > MAX_SORT_DEPTH)
+      return false;
+  }
+  if (costNodes > 0
+   && (costEmpties < 1 || costEmpties > 60 || costEbf < 1.0 || costNps == 0))
+    return false;
+  return true;
+}
+
+bool EndgameConfig::read_file(const std::string &file) {
+  std::ifstream in(file);
+  if (!in.is_open())
+    return false;
+
+  EndgameConfig config = *this;
+  std::string name;
+  while (in >> name) {
+    bool ok;
+    if (name == "end_medium") {
+      ok = static_cast<bool>(in >> config.endMedium);
+    } else if (name == "end_shallow") {
+      ok = static_cast<bool>(in >> config.endShallow);
+    } else if (name == "sort_depths" || name == "root_sort_depths") {
+      int *depths = (name == "sort_depths") ? config.sortDepths : config.rootSortDepths;
+      ok = true;
+      for (int d = 0; d < DEPTHS && ok; d++)
+        ok = static_cast<bool>(in >> depths[d]);
+    } else if (name == "cost_model") {
+      ok = static_cast<bool>(in >> config.costEmpties >> config.costNodes >> config.costEbf
+                                >> config.costNps);
+    } else {
+      ok = false;
     }
+    if (!ok) {
+      cerr << "Error: bad endgame config " << file << " at " << name << endl;
+      return false;
+    }
+  }
+  if (!config.valid()) {
+    cerr << "Error: endgame config " << file << " is out of range" << endl;
+    return false;
+  }
+  *this = config;
+  return true;
+}
+
+bool EndgameConfig::write_file(const std::string &file) {
+  std::ofstream out(file);
+  if (!out.is_open())
+    return false;
+  out << "end_medium " << endMedium << endl;
+  out << "end_shallow " << endShallow << endl;
+  out << "sort_depths";
+  for (int d = 0; d < DEPTHS; d++)
+    out << " " << sortDepths[d];
+  out << endl << "root_sort_depths";
+  for (int d = 0; d < DEPTHS; d++)
+    out << " " << rootSortDepths[d];
+  out << endl;
+  if (costNodes > 0) {
+    out << "cost_model " << costEmpties << " " << costNodes << " " << costEbf << " "
+        << costNps << endl;
+  }
+  return true;
+}
+
+void EndgameStatistics::reset() {
+  for (int d = 0; d < MAX_DEPTH; d++)
+    depths[d] = EndgameDepthStats();
+}
+
+void EndgameStatistics::add(const EndgameStatistics &other) {
+  for (int d = 0; d < MAX_DEPTH; d++) {
+    EndgameDepthStats &s = depths[d];
+    const EndgameDepthStats &o = other.depths[d];
+    s.nodes += o.nodes;
+    s.cuts += o.cuts;
+    s.firstMoveCuts += o.firstMoveCuts;
+    s.hashProbes += o.hashProbes;
+    s.hashHits += o.hashHits;
+    s.hashCuts += o.hashCuts;
+    s.hashMoveAttempts += o.hashMoveAttempts;
+    s.hashMoveCuts += o.hashMoveCuts;
+    s.stabilityAttempts += o.stabilityAttempts;
+    s.stabilityCuts += o.stabilityCuts;
   }
-  // swap to the correct position
-  int temp_move = moves[best_index];
-  moves[best_index] = moves[index];
-  moves[index] = temp_move;
-  // return the move
-  return moves[index];
 }
+
+namespace {
+
+double rate(uint64_t count, uint64_t total) {
+  return (total == 0) ? 0.0 : (double) count / total;
+}
+
+}  // namespace
+
+void EndgameStatistics::print_csv(std::ostream &out) {
+  out << "depth,nodes,cuts,first_move_cuts,cut_rate,first_move_cut_rate,"
+      << "hash_probes,hash_hits,hash_cuts,hash_hit_rate,hash_cut_rate,"
+      << "hash_move_attempts,hash_move_cuts,stability_attempts,stability_cuts" << endl;
+  for (int d = MAX_DEPTH - 1; d >= 0; d--) {
+    const EndgameDepthStats &s = depths[d];
+    if (s.nodes == 0)
+      continue;
+    out << d << "," << s.nodes << "," << s.cuts << "," << s.firstMoveCuts << ","
+        << rate(s.cuts, s.nodes) << "," << rate(s.firstMoveCuts, s.cuts) << ","
+        << s.hashProbes << "," << s.hashHits << "," << s.hashCuts << ","
+        << rate(s.hashHits, s.hashProbes) << "," << rate(s.hashCuts, s.hashHits) << ","
+        << s.hashMoveAttempts << "," << s.hashMoveCuts << ","
+        << s.stabilityAttempts << "," << s.stabilityCuts << endl;
+  }
+}
+
+void EndgameStatistics::print_json(std::ostream &out) {
+  out << "[";
+  bool first = true;
+  for (int d = MAX_DEPTH - 1; d >= 0; d--) {
+    const EndgameDepthStats &s = depths[d];
+    if (s.nodes == 0)
+      continue;
+    if (!first)
+      out << ",";
+    first = false;
+    out << "{\"depth\":" << d << ",\"nodes\":" << s.nodes
+        << ",\"cuts\":" << s.cuts << ",\"first_move_cuts\":" << s.firstMoveCuts
+        << ",\"cut_rate\":" << rate(s.cuts, s.nodes)
+        << ",\"first_move_cut_rate\":" << rate(s.firstMoveCuts, s.cuts)
+        << ",\"hash_probes\":" << s.hashProbes << ",\"hash_hits\":" << s.hashHits
+        << ",\"hash_cuts\":" << s.hashCuts
+        << ",\"hash_hit_rate\":" << rate(s.hashHits, s.hashProbes)
+        << ",\"hash_cut_rate\":" << rate(s.hashCuts, s.hashHits)
+        << ",\"hash_move_attempts\":" << s.hashMoveAttempts
+        << ",\"hash_move_cuts\":" << s.hashMoveCuts
+        << ",\"stability_attempts\":" << s.stabilityAttempts
+        << ",\"stability_cuts\":" << s.stabilityCuts << "}";
+  }
+  out << "]" << endl;
+}
+
@@ -1,14 +1,80 @@
 #ifndef __ENDGAME_H__
 #define __ENDGAME_H__
 
+#include <ostream>
+#include <string>
+#include <vector>
 #include "common.h"
 #include "board.h"
 #include "endhash.h"
 #include "eval.h"
 #include "hash.h"
 #include "search.h"
+#include "searchcontrol.h"
 
-struct EndgameStatistics;
+// Set to true to count per-depth statistics in the endgame solver, for tuning
+// its depth thresholds with testsuites eg and ffo. Off for play, since the
+// counting slows the solver down.
+#ifndef ENDGAME_STATS
+#define ENDGAME_STATS false
+#endif
+
+// Counters for the nodes with a given number of empty squares.
+struct EndgameDepthStats {
+  uint64_t nodes;
+  // Nodes that failed high, and those that did on the first move tried
+  uint64_t cuts, firstMoveCuts;
+  // Hash table probes, probes that found an entry, and entries that ended
+  // the search of the node
+  uint64_t hashProbes, hashHits, hashCuts;
+  uint64_t hashMoveAttempts, hashMoveCuts;
+  uint64_t stabilityAttempts, stabilityCuts;
+};
+
+struct EndgameStatistics {
+  static const int MAX_DEPTH = 64;
+  EndgameDepthStats depths[MAX_DEPTH];
+
+  EndgameStatistics() { reset(); }
+  void reset();
+  void add(const EndgameStatistics &other);
+  // One row or object per depth with any nodes, deepest first, with the cut
+  // and hash hit rates.
+  void print_csv(std::ostream &out);
+  void print_json(std::ostream &out);
+};
+
+// Depth thresholds of the endgame solver, by number of empty squares. The
+// defaults were picked by hand on a 7700K. testsuites tune finds values for
+// other hardware and writes them to a file, which Player reads on startup.
+struct EndgameConfig {
+  static const int DEPTHS = 40;
+  static const int MAX_END_MEDIUM = 20;
+  // At or below endMedium empties, the solver stops using sort searches, and
+  // at or below endShallow, it also stops using the hash tables.
+  int endMedium;
+  int endShallow;
+  // Depths of the sort searches that order moves in the solver, and of the
+  // iterative deepening that orders the root moves.
+  int sortDepths[DEPTHS];
+  int rootSortDepths[DEPTHS];
+  // Solve cost model for the time manager, measured by testsuites tune: an
+  // exact solve at costEmpties takes costNodes nodes on average, each further
+  // empty square multiplies this by costEbf, and one solver thread searches
+  // costNps nodes per second. costNodes is 0 if not measured.
+  int costEmpties;
+  double costNodes;
+  double costEbf;
+  uint64_t costNps;
+
+  EndgameConfig();
+  // Checks that the values can be used by the solver.
+  bool valid();
+  // Files have lines of a name followed by its values. Reading fails, and
+  // leaves the config unchanged, if the file is missing or not valid.
+  bool read_file(const std::string &file);
+  bool write_file(const std::string &file);
+};
 
 // Resizes all endgame hash tables with:
 // 2^pv_bits entries for the PV table
@@ -16,12 +82,37 @@ struct EndgameStatistics;
 // 2^(pv_bits+8) entries for the all table
 // 2^(pv_bits+2) entries for the sort search table
 void resize_endhash(uint32_t pv_bits);
+// Resizes the endgame PV, cut and all tables to fit in about the given number
+// of bytes together, in the same proportions. The sort search table keeps its
+// size, since a Player's solver sorts with the player's midgame table.
+void resize_endhash_bytes(uint64_t bytes);
+// Prints the size of the endgame PV, cut and all tables.
+void print_endhash_memory(std::ostream &out);
+// Empties all endgame tables, for timing solves from a cold start.
+void clear_endhash();
+// Permille of the cut table in use, the largest of the endgame tables.
+int endhash_full();
 
 // This class contains a large number of functions to help solve the endgame
 // for a game result or perfect play.
 class Endgame {
  public:
   uint64_t nodes;
+  // Number of threads used to split the root moves of a solve.
+  int threads;
+  // If set, solves also stop when this is stopped, for example by a stop
+  // command from the protocol thread.
+  const SearchControl *stopControl;
+  // Table for the sort searches, and for the sort search moves probed at PV
+  // nodes of the deep endgame. A private table by default, but a Player sets
+  // its midgame table, so that the stages of a move share what they found.
+  Hash *sortTable;
+  // Principal variation of the last solve, starting with the best move. Only
+  // exact solves get the full variation.
+  std::vector<int> pv;
+  // Statistics of the last solve, only counted if ENDGAME_STATS is true.
+  EndgameStatistics stats;
+  EndgameConfig config;
 
   Endgame();
   ~Endgame() = default;
@@ -40,6 +131,12 @@ class Endgame {
    */
   int solve_endgame(Board &b, Eval* e, Color c, ArrayList &moves, bool is_sorted, int depth,
     int time_limit, int *exact_score = NULL);
+  // Solves for perfect play, with moves already sorted by an earlier search,
+  // such as the midgame iterations of a move. Its score, in eval units,
+  // centers the aspiration window, as the solver's own sort search score
+  // would.
+  int solve_endgame_sorted(Board &b, Eval* e, Color c, ArrayList &moves, int depth,
+    int sort_score, int time_limit, int *exact_score = NULL);
   // Solve the game for final result: win, loss, or draw.
   int solve_wld(Board &b, Eval* e, Color c, ArrayList &moves, bool is_sorted, int depth,
     int time_limit, int *exact_score = NULL);
@@ -48,14 +145,40 @@ class Endgame {
   // A window of -1, 1 is win/loss/draw.
   int solve_endgame_with_window(Board &b, Eval* e, Color c, ArrayList &moves, bool is_sorted,
     int depth, int alpha, int beta, int time_limit, int *exact_score = NULL);
+  // Solves the k best moves exactly, and reorders moves so that these come
+  // first, best first. Fills lines with their scores and PVs. Returns the
+  // number of lines, or MOVE_BROKEN if the time limit was reached.
+  int solve_multi_pv(Board &b, Eval* e, Color c, ArrayList &moves, bool is_sorted, int depth,
+    int k, int time_limit, std::vector<PVLine> &lines);
 
  private:
-  TimePoint searchStart;
-  uint64_t timeout;
+  // Stops the current solve on its time limit or stopControl. Parallel root
+  // search workers get a child of this, which is also stopped on a cutoff.
+  const SearchControl *control;
 
+  // solve_endgame_with_window(), with the score of the search that sorted
+  // moves if sort_score is given.
+  int solve_root(Board &b, Eval* e, Color c, ArrayList &moves, bool is_sorted,
+    const int *sort_score, int depth, int alpha, int beta, int time_limit, int *exact_score);
+  // Sorts the root moves with sort searches of increasing depth. Returns the
+  // sort search score of the best move.
+  int sort_root_moves(Board &b, Eval* e, Color c, ArrayList &moves, int depth, SearchInfo* search_info);
   // Performs an aspiration search. Returns the index of the best move.
   int endgame_aspiration(Board &b, Eval* e, Color c, ArrayList &moves, int depth,
     int alpha, int beta, int &exact_score, SearchInfo* search_info);
+  // Searches the root moves in parallel on threads workers, which share the
+  // hash tables. Stops as soon as one move is proven >= beta. Returns the
+  // index of the best move, as endgame_aspiration does.
+  int endgame_root_parallel(Board &b, Eval* e, Color c, ArrayList &moves, int depth,
+    int alpha, int beta, int &exact_score, SearchInfo* search_info);
+  // Move ordering scores for the root moves, keeping the first move first.
+  ArrayList root_priorities(Board &b, Eval* e, Color c, ArrayList &moves, int depth,
+    SearchInfo* search_info);
+  // Finds the principal variation of a move with a known exact score, by
+  // following the PV table and otherwise searching for a reply that keeps the
+  // score, with windows of width 2 that mostly hit the hash tables.
+  std::vector<int> principal_variation(Board &b, Eval* e, Color c, int move, int score,
+    SearchInfo* search_info);
   // From root, this function chooses the correct helper to call.
   int dispatch(Board &b, Eval* e, Color c, int depth, int alpha, int beta, SearchInfo* search_info);
   // Function for endgame solver, used when many empty squares remain.
@@ -69,17 +192,20 @@ class Endgame {
   // sorted by hole parity and piece square tables. The ArrayList is dropped
   // in favor of a faster array on the stack with SIMD for moves and scores.
   int endgame_shallow(Board &b, Color c, int depth, int alpha, int beta, bool passed_last);
-  // Endgame solvers, to be used with exactly 1-4 moves remaining.
-  // At depth 4, only hole parity is used for sorting. Each empty square is tested
-  //             directly for legality. Null window searches are no longer done.
+  // Endgame solvers, to be used with exactly 1 to END_UNROLLED moves remaining.
+  // At depth 3 and up, endgame_n<D> is generated for each depth from one
+  // template. Only hole parity is used for sorting. Each empty square is
+  // tested directly for legality. Null window searches are no longer done.
+  // The D empty squares are passed in from the parent.
   // At depth 2, the move loop is manually unrolled.
   // At depth 1, the flipped stones are counted without making the move on the board.
-  int endgame4(Board &b, Color c, int alpha, int beta, bool passed_last);
-  int endgame3(Board &b, Color c, int alpha, int beta, bool passed_last);
+  template <int D>
+  int endgame_n(Board &b, Color c, int alpha, int beta, bool passed_last, const int *empties);
+  // Finds the empty squares and selects endgame_n<depth>, for 2 <= depth <= D.
+  template <int D>
+  int endgame_unrolled(Board &b, Color c, int depth, int alpha, int beta, bool passed_last);
   int endgame2(Board &b, Color c, int alpha, int beta, int lm1, int lm2);
   int endgame1(Board &b, Color c, int alpha, int legal_move);
-
-  int next_move_shallow(int *moves, int size, int index);
 };
 
 #endif
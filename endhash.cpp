@@ -1,11 +1,14 @@
 #include "endhash.h"
 
+#include <algorithm>
 #include <cstring>
 
 EndHash::EndHash(uint32_t bits) {
   if (bits < 10) bits = 10;
   size = 1 << bits;
   table = new EndgameEntry[size];
+  generation = 1;
+  epoch = 1;
 }
 
 EndHash::~EndHash() {
@@ -13,36 +16,48 @@ EndHash::~EndHash() {
 }
 
 void EndHash::add(Board &b, Color c, int score, int move, int depth) {
-  uint32_t index = b.hash() & (size-1);
-  EndgameEntry *node = &(table[index]);
+  EndgameEntry *node = &(table[index(b)]);
   // Replacement strategy
-  if (depth + 2 >= node->depth) {
-    node->set_entry(b.get_bits(WHITE), b.get_bits(BLACK), c, score, move, depth);
+  if (node->epoch != epoch || node->age != generation || depth + 2 >= node->depth) {
+    node->set_entry(b.get_bits(WHITE), b.get_bits(BLACK), c, score, move, depth, generation,
+      epoch);
   }
 }
 
 // Get the move, if any, associated with a board b and player to move.
-EndgameEntry *EndHash::get(Board &b, Color c) {
-  uint32_t index = b.hash() & (size-1);
-  EndgameEntry *node = &(table[index]);
-
-  if (node->white == b.get_bits(WHITE)
-   && node->black == b.get_bits(BLACK)
-   && node->color == (uint8_t) c) {
-    return node;
+bool EndHash::get(Board &b, Color c, EndgameEntry *entry) {
+  // Copy first so that the check and the returned data are the same
+  *entry = table[index(b)];
+  uint64_t data = entry->data();
+
+  if ((entry->white ^ data) == b.get_bits(WHITE)
+   && (entry->black ^ data) == b.get_bits(BLACK)
+   && entry->color == (uint8_t) c
+   && entry->epoch == epoch) {
+    entry->white = b.get_bits(WHITE);
+    entry->black = b.get_bits(BLACK);
+    return true;
   }
 
-  return nullptr;
+  return false;
 }
 
 int EndHash::hash_full() {
   int used = 0;
   for (int i = 0; i < 1000; i++) {
-    used += table[i].depth > 0;
+    used += table[i].epoch == epoch && table[i].age == generation;
   }
   return used;
 }
 
+void EndHash::new_search() {
+  generation++;
+  if (generation == 0) {
+    clear();
+    generation = 1;
+  }
+}
+
 void EndHash::resize(uint32_t bits) {
   if (bits < 10) bits = 10;
   delete[] table;
@@ -50,6 +65,17 @@ void EndHash::resize(uint32_t bits) {
   table = new EndgameEntry[size];
 }
 
+void EndHash::resize_bytes(uint64_t bytes) {
+  uint64_t entries = std::min(bytes / sizeof(EndgameEntry), (uint64_t) UINT32_MAX);
+  delete[] table;
+  size = (uint32_t) std::max(entries, (uint64_t) 1024);
+  table = new EndgameEntry[size];
+}
+
 void EndHash::clear() {
-  std::memset(static_cast<void*>(table), 0, size * sizeof(EndgameEntry));
+  epoch++;
+  if (epoch == 0) {
+    std::memset(static_cast<void*>(table), 0, size * sizeof(EndgameEntry));
+    epoch = 1;
+  }
 }
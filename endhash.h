@@ -4,28 +4,45 @@
 #include "board.h"
 #include "common.h"
 
+// The bitboards are stored xor'd with the packed data fields, so that an
+// entry torn by two threads writing at once fails the key check instead of
+// returning a score for the wrong position (lockless hashing as in Crafty).
 struct EndgameEntry {
   uint64_t white, black;
   uint8_t color;
   int8_t score;
   uint8_t move;
   uint8_t depth;
+  // The search generation that stored this entry
+  uint16_t age;
+  // Entries from before the last EndHash::clear() have an older epoch
+  uint16_t epoch;
 
   EndgameEntry() {
-    set_entry(0, 0, WHITE, 0, 0, 0);
+    set_entry(0, 0, WHITE, 0, 0, 0, 0, 0);
   }
   ~EndgameEntry() = default;
 
-  void set_entry(uint64_t w, uint64_t b, Color c, int s, int m, int d) {
-    white = w;
-    black = b;
+  void set_entry(uint64_t w, uint64_t b, Color c, int s, int m, int d, uint16_t a,
+    uint16_t ep) {
     color = (uint8_t) c;
     score = (int8_t) s;
     move = (uint8_t) m;
     depth = (uint8_t) d;
+    age = a;
+    epoch = ep;
+    white = w ^ data();
+    black = b ^ data();
+  }
+
+  uint64_t data() {
+    return ((uint64_t) epoch << 48) | ((uint64_t) age << 32) | ((uint64_t) color << 24)
+         | ((uint64_t) (uint8_t) score << 16) | ((uint64_t) move << 8) | depth;
   }
 };
 
+static_assert(sizeof(EndgameEntry) == 24, "EndgameEntry should stay at 24 bytes");
+
 class EndHash {
  public:
   // Creates a endgame hashtable, with argument in number of bits for the bitmask
@@ -35,18 +52,40 @@ class EndHash {
   EndHash(const EndHash &other) = delete;
   EndHash& operator=(const EndHash &other) = delete;
 
-  // Adds key (board, color) and item move into the hashtable.
+  // Adds key (board, color) and item move into the hashtable. Entries from
+  // earlier searches are always replaced, and entries from this search only
+  // by ones of about the same depth or more.
   // Assumes that this key has been checked with get() and is not in the table.
   void add(Board &b, Color c, int score, int move, int depth);
-  EndgameEntry *get(Board &b, Color c);
+  // Copies the entry for (board, color) into entry, with the bitboards
+  // decoded. Returns false if there is none. Safe to call while other threads
+  // are adding to the table.
+  bool get(Board &b, Color c, EndgameEntry *entry);
+  // Permille of the table used by the current search
   int hash_full();
 
+  // Starts a new search generation, without clearing. Entries from earlier
+  // searches can still be found, but give way to new ones. When the
+  // generation wraps around, the table is cleared, so that no entry from
+  // 2^16 searches ago passes as one of this search.
+  void new_search();
   void resize(uint32_t bits);
+  // Resizes to as many entries as fit in the given number of bytes, which
+  // need not be a power of two.
+  void resize_bytes(uint64_t bytes);
+  uint64_t bytes() { return (uint64_t) size * sizeof(EndgameEntry); }
+  // Empties the table in O(1) by starting a new epoch, as Hash::clear() does.
   void clear();
 
  private:
   EndgameEntry *table;
   uint32_t size;
+  uint16_t generation;
+  uint16_t epoch;
+
+  // Maps the hash to an entry with a multiply and shift, which works for any
+  // table size.
+  uint32_t index(Board &b) { return (uint32_t) (((uint64_t) b.hash() * size) >> 32); }
 };
 
 #endif
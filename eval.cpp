@@ -1,6 +1,7 @@
 #include "eval.h"
 
 #include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <functional>
 #include <iostream>
@@ -676,3 +677,39 @@ int score_game_end(Board& b, Color c) {
     return EVAL_SCALE_FACTOR * (-64 - theirCt) / 2;
   return EVAL_SCALE_FACTOR * (ourCt - theirCt);
 }
+
+EvalCache::EvalCache(uint32_t bits) {
+  size = 1 << bits;
+  table = new EvalCacheEntry[size];
+  clear();
+}
+
+EvalCache::~EvalCache() {
+  delete[] table;
+}
+
+void EvalCache::add(Board &b, Color c, int score) {
+  EvalCacheEntry *entry = &(table[b.hash() & (size-1)]);
+  entry->score = score;
+  entry->color = (uint8_t) c;
+  entry->white = b.get_bits(WHITE) ^ entry->data();
+  entry->black = b.get_bits(BLACK) ^ entry->data();
+}
+
+bool EvalCache::get(Board &b, Color c, int *score) {
+  // Copy first so that the check and the returned score are the same
+  EvalCacheEntry entry = table[b.hash() & (size-1)];
+  uint64_t data = entry.data();
+  if ((entry.white ^ data) == b.get_bits(WHITE)
+   && (entry.black ^ data) == b.get_bits(BLACK)
+   && entry.color == (uint8_t) c) {
+    *score = entry.score;
+    return true;
+  }
+  return false;
+}
+
+void EvalCache::clear() {
+  // An empty board is never evaluated, so zeroed entries never match
+  std::memset(static_cast<void*>(table), 0, size * sizeof(EvalCacheEntry));
+}
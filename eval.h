@@ -23,4 +23,41 @@ int heuristic(Board &b, Eval* e, Color c);
 int stability(Board &b, Color c);
 int score_game_end(Board& b, Color c);
 
+// A cached heuristic() score. The bitboards are stored xor'd with the packed
+// score and color, as in EndgameEntry, so that a torn entry fails the check.
+struct EvalCacheEntry {
+  uint64_t white, black;
+  int32_t score;
+  uint8_t color;
+
+  uint64_t data() {
+    return ((uint64_t) (uint32_t) score << 8) | color;
+  }
+};
+
+// A small, lossy, direct-mapped cache of static evaluations, for the
+// positions that overlapping sort searches and iterative deepening evaluate
+// again. New scores always replace old ones. The pattern values used depend
+// only on the board, so the board and side to move are the whole key. The
+// default size, 8192 entries of 24 bytes, keeps the table within L2.
+const int EVAL_CACHE_BITS = 13;
+
+class EvalCache {
+ public:
+  EvalCache(uint32_t bits);
+  ~EvalCache();
+  EvalCache(const EvalCache &other) = delete;
+  EvalCache& operator=(const EvalCache &other) = delete;
+
+  void add(Board &b, Color c, int score);
+  // Gets the score for (board, color), if cached. Safe to call while other
+  // threads are adding to the cache.
+  bool get(Board &b, Color c, int *score);
+  void clear();
+
+ private:
+  EvalCacheEntry *table;
+  uint32_t size;
+};
+
 #endif
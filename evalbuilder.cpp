@@ -375,7 +375,6 @@ bool analyze_book_balance(const string &position, int depth, int bound) {
 
   SearchInfo search_info;
   search_info.root_age = 64 - b.count_empty();
-  search_info.time_limit = 0;
   search_info.tt = &transpositionTable;
   search_info.other_heuristic = false;
   Eval e;
@@ -485,7 +484,6 @@ int pvs_prune(const string& position, int depth) {
   Hash transpositionTable(10);
   SearchInfo search_info;
   search_info.root_age = 64 - b.count_empty();
-  search_info.time_limit = 0;
   search_info.tt = &transpositionTable;
   search_info.other_heuristic = false;
   Eval e;
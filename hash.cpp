@@ -1,11 +1,15 @@
 #include "hash.h"
 
+#include <algorithm>
 #include <cstring>
 
 Hash::Hash(uint32_t bits) {
   if (bits < 10) bits = 10;
   size = 1 << bits;
   table = new HashNode[size];
+  // More than the 60 empties of any position
+  symmetricEmpties = 64;
+  epoch = 1;
 }
 
 Hash::~Hash() {
@@ -13,25 +17,50 @@ Hash::~Hash() {
 }
 
 void Hash::add(Board &b, Color c, int score, int selectivity, int move, uint8_t turn, int depth, uint8_t node_type) {
-  uint32_t index = b.hash() & (size-1);
-  HashNode *node = &(table[index]);
-  if (node->entry1.taken == 0) {
-    node->entry1.setData(b.occupied(), b.get_bits(BLACK), c, score, selectivity, move, turn, depth, node_type);
+  if (b.count_empty() >= symmetricEmpties) {
+    int s;
+    Board key = b.canonical(&s);
+    if (move < 64)
+      move = transform_move(move, s);
+    store(key, c, score, selectivity, move, turn, depth, node_type);
+  } else {
+    store(b, c, score, selectivity, move, turn, depth, node_type);
+  }
+}
+
+bool Hash::get(Board &b, Color c, HashEntry *entry) {
+  int s = 0;
+  bool found;
+  if (b.count_empty() >= symmetricEmpties) {
+    Board key = b.canonical(&s);
+    found = find(key, c, entry);
+  } else {
+    found = find(b, c, entry);
+  }
+  if (!found)
+    return false;
+
+  if (s != 0 && entry->move < 64)
+    entry->move = inverse_transform_move(entry->move, s);
+  return true;
+}
+
+void Hash::store(Board &b, Color c, int score, int selectivity, int move, uint8_t turn, int depth, uint8_t node_type) {
+  HashNode *node = &(table[index(b)]);
+  // Empty slots and slots from before the last clear are free
+  if (node->entry1.epoch != epoch) {
+    node->entry1.setData(b.occupied(), b.get_bits(BLACK), c, score, selectivity, move, turn, depth, node_type, epoch);
     return;
   }
-  if (node->entry2.taken == 0) {
-    node->entry2.setData(b.occupied(), b.get_bits(BLACK), c, score, selectivity, move, turn, depth, node_type);
+  if (node->entry2.epoch != epoch) {
+    node->entry2.setData(b.occupied(), b.get_bits(BLACK), c, score, selectivity, move, turn, depth, node_type, epoch);
     return;
   }
   // Always update the same position with newer information
-  if (node->entry1.taken == b.occupied()
-   && node->entry1.black == b.get_bits(BLACK)
-   && node->entry1.color == (uint8_t) c) {
-    node->entry1.setData(b.occupied(), b.get_bits(BLACK), c, score, selectivity, move, turn, depth, node_type);
-  } else if (node->entry2.taken == b.occupied()
-      && node->entry2.black == b.get_bits(BLACK)
-      && node->entry2.color == (uint8_t) c) {
-    node->entry2.setData(b.occupied(), b.get_bits(BLACK), c, score, selectivity, move, turn, depth, node_type);
+  if (node->entry1.matches(b.occupied(), b.get_bits(BLACK), c, epoch)) {
+    node->entry1.setData(b.occupied(), b.get_bits(BLACK), c, score, selectivity, move, turn, depth, node_type, epoch);
+  } else if (node->entry2.matches(b.occupied(), b.get_bits(BLACK), c, epoch)) {
+    node->entry2.setData(b.occupied(), b.get_bits(BLACK), c, score, selectivity, move, turn, depth, node_type, epoch);
   } else {
     HashEntry *to_replace = nullptr;
     // Prioritize entries with a higher depth, but also from a more
@@ -48,35 +77,31 @@ void Hash::add(Board &b, Color c, int score, int selectivity, int move, uint8_t
     }
 
     if (to_replace != nullptr) {
-      to_replace->setData(b.occupied(), b.get_bits(BLACK), c, score, selectivity, move, turn, depth, node_type);
+      to_replace->setData(b.occupied(), b.get_bits(BLACK), c, score, selectivity, move, turn, depth, node_type, epoch);
     }
   }
 }
 
-HashEntry *Hash::get(Board &b, Color c) {
-  uint32_t index = b.hash() & (size-1);
-  HashNode *node = &(table[index]);
+bool Hash::find(Board &b, Color c, HashEntry *entry) {
+  HashNode *node = &(table[index(b)]);
 
-  if (node->entry1.taken == b.occupied()
-   && node->entry1.black == b.get_bits(BLACK)
-   && node->entry1.color == (uint8_t) c) {
-    return &(node->entry1);
+  // Copy first so that the check and the returned data are the same
+  *entry = node->entry1;
+  if (!entry->matches(b.occupied(), b.get_bits(BLACK), c, epoch)) {
+    *entry = node->entry2;
+    if (!entry->matches(b.occupied(), b.get_bits(BLACK), c, epoch))
+      return false;
   }
-
-  if (node->entry2.taken == b.occupied()
-   && node->entry2.black == b.get_bits(BLACK)
-   && node->entry2.color == (uint8_t) c) {
-    return &(node->entry2);
-  }
-
-  return nullptr;
+  entry->taken = b.occupied();
+  entry->black = b.get_bits(BLACK);
+  return true;
 }
 
 int Hash::hash_full() {
   int used = 0;
   for (int i = 0; i < 500; i++) {
-    used += (table[i].entry1.taken) != 0;
-    used += (table[i].entry2.taken) != 0;
+    used += table[i].entry1.epoch == epoch;
+    used += table[i].entry2.epoch == epoch;
   }
   return used;
 }
@@ -88,6 +113,17 @@ void Hash::resize(uint32_t bits) {
   table = new HashNode[size];
 }
 
+void Hash::resize_bytes(uint64_t bytes) {
+  uint64_t slots = std::min(bytes / sizeof(HashNode), (uint64_t) UINT32_MAX);
+  delete[] table;
+  size = (uint32_t) std::max(slots, (uint64_t) 1024);
+  table = new HashNode[size];
+}
+
 void Hash::clear() {
-  std::memset(static_cast<void*>(table), 0, size * sizeof(HashNode));
+  epoch++;
+  if (epoch == 0) {
+    std::memset(static_cast<void*>(table), 0, size * sizeof(HashNode));
+    epoch = 1;
+  }
 }
@@ -4,6 +4,9 @@
 #include "board.h"
 #include "common.h"
 
+// As for EndgameEntry, the bitboards are stored xor'd with the other fields,
+// so that an entry torn by two threads writing at once fails the key check
+// instead of returning the score or move of another position.
 struct HashEntry {
   uint64_t taken;
   uint64_t black;
@@ -14,19 +17,20 @@ struct HashEntry {
   uint8_t turn;
   uint8_t depth;
   uint8_t nodeType;
+  // Entries from before the last Hash::clear() have an older epoch
+  uint16_t epoch;
 
   HashEntry() {
-    setData(0, 0, WHITE, 0, 0, 0, 0, 0, 0);
+    setData(0, 0, WHITE, 0, 0, 0, 0, 0, 0, 0);
   }
-  HashEntry(uint64_t t, uint64_t b, Color c, int s, int sel, int m, uint8_t tu, int d, uint8_t nt) {
-    setData(t, b, c, s, sel, m, tu, d, nt);
+  HashEntry(uint64_t t, uint64_t b, Color c, int s, int sel, int m, uint8_t tu, int d, uint8_t nt,
+    uint16_t ep) {
+    setData(t, b, c, s, sel, m, tu, d, nt, ep);
   }
   ~HashEntry() = default;
 
   void setData(uint64_t t, uint64_t b, Color c, int s, int sel, int m, uint8_t tu, int d,
-    uint8_t nt) {
-    taken = t;
-    black = b;
+    uint8_t nt, uint16_t ep) {
     score = s;
     selectivity = sel;
     color = (uint8_t) c;
@@ -34,6 +38,24 @@ struct HashEntry {
     turn = tu;
     depth = (uint8_t) d;
     nodeType = nt;
+    epoch = ep;
+    taken = t ^ score_data();
+    black = b ^ age_data();
+  }
+
+  // The fields xor'd into taken
+  uint64_t score_data() {
+    return (uint64_t) (uint32_t) score | ((uint64_t) selectivity << 32) | ((uint64_t) move << 40)
+         | ((uint64_t) depth << 48) | ((uint64_t) nodeType << 56);
+  }
+  // The fields xor'd into black
+  uint64_t age_data() {
+    return (uint64_t) color | ((uint64_t) turn << 8) | ((uint64_t) epoch << 16);
+  }
+
+  bool matches(uint64_t t, uint64_t b, Color c, uint16_t ep) {
+    return (taken ^ score_data()) == t && (black ^ age_data()) == b
+        && color == (uint8_t) c && epoch == ep;
   }
 };
 
@@ -42,12 +64,17 @@ class HashNode {
   HashEntry entry1, entry2;
 
   HashNode() = default;
-  HashNode(uint64_t t, uint64_t b, Color c, int s, int sel, int m, uint8_t tu, int d, uint8_t nt) {
-    entry1 = HashEntry(t, b, c, s, sel, m, tu, d, nt);
+  HashNode(uint64_t t, uint64_t b, Color c, int s, int sel, int m, uint8_t tu, int d, uint8_t nt,
+    uint16_t ep) {
+    entry1 = HashEntry(t, b, c, s, sel, m, tu, d, nt, ep);
   }
   ~HashNode() = default;
 };
 
+// For Hash::set_symmetric(): the first 20 plies, where symmetric positions
+// are most common.
+const int SYMMETRIC_EMPTIES = 40;
+
 class Hash {
  public:
   // Creates a hashtable, with argument in number of bits for the bitmask
@@ -58,16 +85,43 @@ class Hash {
   // Adds a hash entry into the table.
   // Assumes that this key has been checked with get() and is not in the table.
   void add(Board &b, Color c, int score, int selectivity, int move, uint8_t turn, int depth, uint8_t node_type);
-  // Get the move, if any, associated with a board b and player color c.
-  HashEntry *get(Board &b, Color c);
+  // Copies the entry, if any, for board b and player color c into entry.
+  // Returns false if there is none. Safe to call while other threads are
+  // adding to the table.
+  bool get(Board &b, Color c, HashEntry *entry);
   int hash_full();
 
+  // Positions with at least min_empties empty squares are stored under their
+  // canonical symmetry, so that symmetric positions share one entry. Hash
+  // moves are mapped back to the orientation of the probing board. Only worth
+  // the cost of canonicalizing where positions repeat in other orientations,
+  // such as early in the game or across many analyzed positions. Off by
+  // default.
+  void set_symmetric(int min_empties) { symmetricEmpties = min_empties; }
+
   void resize(uint32_t bits);
+  // Resizes to as many slots as fit in the given number of bytes, which need
+  // not be a power of two.
+  void resize_bytes(uint64_t bytes);
+  uint64_t bytes() { return (uint64_t) size * sizeof(HashNode); }
+  // Empties the table in O(1) by starting a new epoch. Entries of earlier
+  // epochs are never found, and are overwritten as if empty. The table is
+  // only zeroed once every 2^16 - 1 clears, when the epoch wraps around.
   void clear();
 
  private:
   HashNode *table;
   uint32_t size;
+  int symmetricEmpties;
+  uint16_t epoch;
+
+  // Maps the hash to a slot with a multiply and shift, which works for any
+  // table size.
+  uint32_t index(Board &b) { return (uint32_t) (((uint64_t) b.hash() * size) >> 32); }
+  void store(Board &b, Color c, int score, int selectivity, int move, uint8_t turn, int depth, uint8_t node_type);
+  // Copies the entry for board b and player color c, with the bitboards
+  // decoded, into entry. Returns false if there is none.
+  bool find(Board &b, Color c, HashEntry *entry);
 
   Hash(const Hash &other);
   Hash& operator=(const Hash &other);
@@ -1,73 +1,123 @@
 #include "openings.h"
+#include <algorithm>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 
-Openings::Openings() {
-  if (!read_file())
-    std::cerr << "Error: opening book not found." << std::endl;
+Openings::Openings() : rng(std::random_device()()) {
+  randomMargin = 0;
 }
 
-Openings::~Openings() {
-  delete[] openings;
-}
+bool Openings::read_file(const std::string &file) {
+  std::ifstream in(file);
+  if (!in.is_open())
+    return false;
 
-int Openings::get(uint64_t taken, uint64_t black) {
-  int index = binary_search(taken, black);
-  if (index == -1) {
-    return OPENING_NOT_FOUND;
+  std::string line;
+  // Discard the first line, which contains the size
+  getline(in, line);
+  while (getline(in, line)) {
+    std::stringstream ss(line);
+    std::vector<std::string> parts;
+    std::string part;
+    while (ss >> part)
+      parts.push_back(part);
+
+    uint64_t taken = std::stoull(parts[0], nullptr, 16);
+    uint64_t black = std::stoull(parts[1], nullptr, 16);
+    Board b(taken & ~black, black);
+    if (parts.size() == 3) {
+      // Old books only have one move for the side to move without passes
+      Color c = (count_bits(taken) % 2 == 0) ? BLACK : WHITE;
+      add(b, c, std::stoi(parts[2]), 0);
+    } else if (parts.size() == 5) {
+      Color c = (parts[2] == "b") ? BLACK : WHITE;
+      add(b, c, std::stoi(parts[3]), std::stoi(parts[4]));
+    }
   }
-  else return openings[index].move;
+  #if PRINT_SEARCH_INFO
+  std::cerr << "Opening book read. Contains " << book.size()
+            << " positions." << std::endl;
+  #endif
+  return true;
 }
 
-int Openings::binary_search(uint64_t taken, uint64_t black) {
-  int min = 0;
-  int max = bookSize - 1;
-
-  while (max >= min) {
-    int mid = min + (max - min) / 2;
-    uint64_t ttaken = openings[mid].taken;
-    uint64_t tblack = openings[mid].black;
-    if ((ttaken == taken) && (tblack == black))
-      return mid;
-    else if ((ttaken < taken) || ((ttaken == taken) && (tblack < black))) {
-      min = mid + 1;
-    }
-    else {
-      max = mid - 1;
+bool Openings::write_file(const std::string &file) {
+  // Sort the lines so that book files are deterministic and diffable
+  std::vector<std::string> lines;
+  for (auto it = book.begin(); it != book.end(); ++it) {
+    for (unsigned int i = 0; i < it->second.size(); i++) {
+      std::stringstream ss;
+      ss << "0x" << std::setfill('0') << std::setw(16) << std::hex << it->first.taken
+         << " 0x" << std::setw(16) << it->first.black << std::dec
+         << " " << (it->first.color == BLACK ? "b" : "w")
+         << " " << it->second[i].move << " " << it->second[i].score;
+      lines.push_back(ss.str());
     }
   }
+  std::sort(lines.begin(), lines.end());
 
-  return -1;
+  std::ofstream out(file);
+  if (!out.is_open())
+    return false;
+  out << lines.size() << std::endl;
+  for (unsigned int i = 0; i < lines.size(); i++)
+    out << lines[i] << std::endl;
+  return true;
 }
 
-bool Openings::read_file() {
-  std::string line;
-  std::ifstream openingbk("Flippy_Resources/flippy_book.txt");
+int Openings::get(Board &b, Color c) {
+  std::vector<BookMove> moves;
+  if (!get_moves(b, c, moves))
+    return OPENING_NOT_FOUND;
 
-  if (openingbk.is_open()) {
-    getline(openingbk, line);
-    bookSize = std::stoi(line);
-    openings = new Node[bookSize];
-    #if PRINT_SEARCH_INFO
-    std::cerr << "Opening book read. Contains " << bookSize
-              << " positions." << std::endl;
-    #endif
-    int i = 0;
-    while (getline(openingbk, line)) {
-      std::string::size_type sz = 0;
-      Node temp;
-      temp.taken = std::stoull(line, &sz, 0);
-      line = line.substr(sz);
-      temp.black = std::stoull(line, &sz, 0);
-      line = line.substr(sz);
-      int move = std::stoi(line, &sz, 0);
-      temp.move = move;
-      openings[i] = temp;
-      i++;
+  // Moves are sorted stably by score, so the first is the first best move
+  if (randomMargin <= 0)
+    return moves[0].move;
+
+  // Choose at random between the moves close enough to the best
+  int candidates = 1;
+  while (candidates < (int) moves.size()
+      && moves[candidates].score >= moves[0].score - randomMargin)
+    candidates++;
+  std::uniform_int_distribution<int> choice(0, candidates - 1);
+  return moves[choice(rng)].move;
+}
+
+bool Openings::get_moves(Board &b, Color c, std::vector<BookMove> &moves) {
+  int s;
+  auto it = book.find(key(b, c, &s));
+  if (it == book.end())
+    return false;
+
+  moves = it->second;
+  uint64_t legal = b.legal_moves(c);
+  for (unsigned int i = 0; i < moves.size(); i++)
+    moves[i].move = inverse_transform_move(moves[i].move, s);
+  // Skip illegal moves, which only a corrupt book could have
+  moves.erase(std::remove_if(moves.begin(), moves.end(),
+    [legal](const BookMove &m) { return !(legal & (1ULL << m.move)); }), moves.end());
+  std::stable_sort(moves.begin(), moves.end(),
+    [](const BookMove &x, const BookMove &y) { return x.score > y.score; });
+  return !moves.empty();
+}
+
+void Openings::add(Board &b, Color c, int move, int score) {
+  int s;
+  std::vector<BookMove> &moves = book[key(b, c, &s)];
+  int m = transform_move(move, s);
+  for (unsigned int i = 0; i < moves.size(); i++) {
+    if (moves[i].move == m) {
+      moves[i].score = score;
+      return;
     }
-    openingbk.close();
-    return true;
   }
-  return false;
+  moves.push_back(BookMove{m, score});
+}
+
+BookKey Openings::key(Board &b, Color c, int *symmetry) {
+  Board canonical = b.canonical(symmetry);
+  return BookKey{canonical.occupied(), canonical.get_bits(BLACK), c};
 }
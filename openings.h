@@ -1,26 +1,73 @@
 #ifndef __OPENINGS_H__
 #define __OPENINGS_H__
 
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "board.h"
 #include "common.h"
 
-struct Node {
-  uint64_t taken, black;
+// A book move, with its score for the side to move in eval units.
+struct BookMove {
   int move;
+  int score;
+};
+
+// Book positions are stored in the symmetry with the smallest bitboards, so
+// that all 8 symmetric positions share one entry.
+struct BookKey {
+  uint64_t taken, black;
+  Color color;
+
+  bool operator==(const BookKey &other) const {
+    return taken == other.taken && black == other.black && color == other.color;
+  }
 };
 
+struct BookKeyHash {
+  size_t operator()(const BookKey &k) const {
+    uint64_t h = (k.taken * 0x9E3779B97F4A7C15ULL) ^ (k.black * 0xC2B2AE3D27D4EB4FULL);
+    return (size_t) (h ^ (h >> 29) ^ k.color);
+  }
+};
+
+// The opening book: a tree of positions, with transpositions and symmetric
+// positions merged. Each position, together with the side to move, has a list
+// of scored moves and is found through a hash index. Following a book move
+// leads to the next book position, if any.
 class Openings {
  public:
+  // Moves scoring within this many eval units of the best book move are
+  // played at random, so that more of the book is used. 0 always plays the
+  // first of the best moves in book order, so that book play is deterministic.
+  int randomMargin;
+
   Openings();
-  ~Openings();
+  ~Openings() = default;
 
-  int get(uint64_t taken, uint64_t black);
+  // Reads a book file, adding to the positions already in the book. Lines
+  // are "taken black side move score", with the bitboards in hex and side
+  // b or w. Old books with lines of "taken black move" are also read, with
+  // the side to move from the disc count and a score of 0.
+  bool read_file(const std::string &file);
+  bool write_file(const std::string &file);
 
- private:
-  Node *openings;
-  int bookSize;
+  // Returns a book move for side c, or OPENING_NOT_FOUND.
+  int get(Board &b, Color c);
+  // Gets the book moves for side c in the orientation of b, best first.
+  // Returns false if the position is not in the book.
+  bool get_moves(Board &b, Color c, std::vector<BookMove> &moves);
+  // Adds a move to the book, or updates its score if already there.
+  void add(Board &b, Color c, int move, int score);
+  int size() { return (int) book.size(); }
 
-  int binary_search(uint64_t taken, uint64_t black);
-  bool read_file();
+  // Gets the key of a position, and the symmetry that maps it to the key.
+  BookKey key(Board &b, Color c, int *symmetry);
+
+ private:
+  std::unordered_map<BookKey, std::vector<BookMove>, BookKeyHash> book;
+  std::mt19937 rng;
 };
 
 #endif
@@ -1,28 +1,56 @@
 #include "player.h"
 
 #include <algorithm>
-#include <cmath>
+#include <chrono>
 #include <iostream>
 #include "eval.h"
 
 using namespace std;
 
-Player::Player(Color side, bool use_book, int tt_bits) {
+// Aspiration windows start this far either side of the expected score, from
+// this depth on
+const int ASPIRATION_WINDOW = 2 * EVAL_SCALE_FACTOR;
+const int ASPIRATION_DEPTH = 4;
+
+// Hard limit of the exact solve of a move, which leaves the rest of the
+// move's limit for the midgame search if the solve breaks out. With no limit
+// the solve has none either.
+static int eg_time_limit(int time_allotment, int time_limit) {
+  if (time_limit == 0)
+    return 0;
+  return std::max(1, std::min(time_limit - 40, 2 * time_allotment));
+}
+
+// What is left of a move's hard limit after ms, at least 1 ms. A limit of 0
+// stays 0, for no limit.
+static int time_left(int time_limit, uint64_t ms) {
+  if (time_limit == 0)
+    return 0;
+  return std::max(1, time_limit - (int) ms);
+}
+
+Player::Player(Color side, bool use_book, int tt_bits)
+  : ponderControl(&control), ponderEgControl(&ponderControl) {
   maxDepth = 50;
   endgameDepth = 50;
   forceEgDepth = 16;
-  lastMaxDepth = 0;
 
   mySide = side;
   turn = 4;
   otherHeuristic = false;
   baseSelectivity = 1;
   bufferPerMove = 20;
+  multiPv = 1;
+  prevIterScore = 0;
+  evalProbes = 0;
+  evalHits = 0;
 
   openingBook = nullptr;
   bookExhausted = true;
   if (use_book) {
     openingBook = new Openings();
+    if (!openingBook->read_file("Flippy_Resources/flippy_book.txt"))
+      cerr << "Error: opening book not found." << endl;
     // Set to false to turn on book
     bookExhausted = false;
   }
@@ -30,241 +58,371 @@ Player::Player(Color side, bool use_book, int tt_bits) {
   // Initialize transposition table with 2^20 = 1 million array slots and
   // 2 * 2^20 = 2 million entries
   transpositionTable = new Hash(tt_bits);
+  evalCache = new EvalCache(EVAL_CACHE_BITS);
+  endgameSolver.stopControl = &control;
+  endgameSolver.sortTable = transpositionTable;
+  // Thresholds tuned for this machine by testsuites tune, if any
+  endgameSolver.config.read_file("Flippy_Resources/endgame_config.txt");
+  const EndgameConfig &config = endgameSolver.config;
+  if (config.costNodes > 0) {
+    timeManager.set_endgame_model(config.costEmpties, config.costNodes, config.costEbf,
+      config.costNps);
+  }
+
+  lastMsLeft = -1;
+  ponderMove = MOVE_NULL;
+  ponderSearch = false;
+  ponderResult = MOVE_BROKEN;
+  ponderHit = false;
+  budgetTaken = false;
+  hitAllotment = 0;
+  hitLimit = 0;
+  pondersPredicted = 0;
+  ponderHits = 0;
+  pondersAll = 0;
+  ponderAllottedMs = 0;
+  ponderSavedMs = 0;
 }
 
 Player::~Player() {
+  stop_pondering(MOVE_NULL);
   if (openingBook != nullptr) {
     delete openingBook;
   }
   delete transpositionTable;
+  delete evalCache;
 }
 
 int Player::do_move(int opponents_move, int ms_left) {
+  auto move_start = Clock::now();
+  // On a ponder hit the ponder search is already searching the position after
+  // the opponent's move, and keeps running on the time of this move.
+  bool ponder_hit = ponderThread.joinable() && ponderSearch && ponderMove == opponents_move;
+  if (!ponder_hit)
+    stop_pondering(opponents_move);
+  control.start(0);
+
   // Register opponent's move
-  if (opponents_move != MOVE_NULL) {
+  if (!ponder_hit && opponents_move != MOVE_NULL) {
     game.do_move(~mySide, opponents_move);
   }
-  // If opponent is passing and it isn't the start of the game
-  else if (turn != 4) {
-    // TODO a temporary hack to prevent opening book from crashing
-    bookExhausted = true;
-  }
 
   // We can easily count how many moves have been made from the number of
   // empty squares
   int empties = game.count_empty();
-  turn = 64 - empties;
   #if PRINT_SEARCH_INFO
   cerr << endl;
   cerr << empties << " empty squares. Time left: " << ms_left << " ms" << endl;
   #endif
 
   // Timing
-  // 10 min per move for "infinite" time
-  int time_allotment = 600000;
-  timeLimit = 0;
-  if (ms_left != -1) {
-    // Buffer time: to prevent losses on time at short time controls
-    int buffer_time = 100 + bufferPerMove * empties;
-    ms_left -= buffer_time;
-    time_allotment = std::max(1, ms_left);
-
-    // Base fair time usage off of number of moves left
-    int moves_left = min(max(1, (empties - forceEgDepth) / 2), 18);
-    time_allotment /= moves_left;
-    #if PRINT_SEARCH_INFO
+  int time_allotment, time_limit;
+  allot_time(empties, ms_left, &time_allotment, &time_limit);
+  #if PRINT_SEARCH_INFO
+  if (ms_left != -1)
     cerr << "Allotted time: " << time_allotment / 1000.0 << " s" << endl;
+  #endif
+
+  int my_move = MOVE_BROKEN;
+  if (ponder_hit) {
+    {
+      std::lock_guard<std::mutex> lock(ponderLock);
+      ponderHit = true;
+      ponderHitTime = Clock::now();
+      hitAllotment = time_allotment;
+      hitLimit = time_limit;
+    }
+    ponderWake.notify_one();
+    if (time_limit != 0) {
+      ponderEgControl.set_limit(eg_time_limit(time_allotment, time_limit));
+      ponderControl.set_limit(time_limit);
+    }
+    ponderThread.join();
+    ponderSearch = false;
+    endgameSolver.stopControl = &control;
+    my_move = ponderResult;
+
+    uint64_t ms = get_time_elapsed(ponderHitTime);
+    ponderHits++;
+    ponderAllottedMs += time_allotment;
+    if (ms < (uint64_t) time_allotment)
+      ponderSavedMs += time_allotment - ms;
+    #if PRINT_SEARCH_INFO
+    cerr << "Ponder hit after " << get_time_elapsed(ponderStart) - ms << " ms, "
+         << ms << " ms of " << time_allotment << " ms allotted used after it" << endl;
     #endif
-    // Use up to 5x fair time
-    timeLimit = std::min(time_allotment * 5, ms_left);
   }
+  else {
+    turn = 64 - empties;
+    // Check opening book
+    if (!bookExhausted) {
+      int book_move = openingBook->get(game, mySide);
+      if (book_move != OPENING_NOT_FOUND) {
+        #if PRINT_SEARCH_INFO
+        cerr << "Opening book: bestmove " << print_move(book_move) << endl << endl;
+        #endif
+        game.do_move(mySide, book_move);
+        return book_move;
+      }
+      else
+        bookExhausted = true;
+    }
 
-  // Check opening book
-  if (!bookExhausted) {
-    int book_move = openingBook->get(game.occupied(), game.get_bits(BLACK));
-    if (book_move != OPENING_NOT_FOUND) {
+    // Find and test all legal moves
+    ArrayList legal_moves = game.legal_movelist(mySide);
+    if (legal_moves.size() <= 0) {
       #if PRINT_SEARCH_INFO
-      cerr << "Opening book: bestmove " << print_move(book_move) << endl << endl;
+      cerr << "No legal moves. Passing." << endl << endl;
       #endif
-      game.do_move(mySide, book_move);
-      return book_move;
+      return MOVE_NULL;
     }
-    else
-      bookExhausted = true;
-  }
 
+    if (legal_moves.size() == 1) {
+      #if PRINT_SEARCH_INFO
+      cerr << "One legal move: " << print_move(legal_moves.get(0)) << endl << endl;
+      #endif
+      game.do_move(mySide, legal_moves.get(0));
+      return legal_moves.get(0);
+    }
 
-  // Find and test all legal moves
-  ArrayList legal_moves = game.legal_movelist(mySide);
-  if (legal_moves.size() <= 0) {
-    // TODO a temporary hack to prevent opening book from crashing
-    bookExhausted = true;
-    #if PRINT_SEARCH_INFO
-    cerr << "No legal moves. Passing." << endl << endl;
-    #endif
-    return MOVE_NULL;
+    // Only moves that are searched are timed, and logged
+    timeManager.start_move(empties, time_allotment, time_limit);
+    my_move = think(legal_moves, time_allotment, time_limit, ms_left == -1, move_start, &control,
+      &control);
   }
 
-  if (legal_moves.size() == 1) {
-    #if PRINT_SEARCH_INFO
-    cerr << "One legal move: " << print_move(legal_moves.get(0)) << endl << endl;
-    #endif
-    game.do_move(mySide, legal_moves.get(0));
-    return legal_moves.get(0);
-  }
+  game.do_move(mySide, my_move);
+  lastMsLeft = (ms_left == -1) ? -1 : ms_left - (int) get_time_elapsed(move_start);
+  return my_move;
+}
+
+void Player::allot_time(int empties, int ms_left, int *allotment, int *limit) {
+  // 10 min per move for "infinite" time
+  *allotment = 600000;
+  *limit = 0;
+  if (ms_left == -1)
+    return;
+  // Buffer time: to prevent losses on time at short time controls
+  int buffer_time = 100 + bufferPerMove * empties;
+  ms_left -= buffer_time;
+  *allotment = std::max(1, ms_left);
+
+  // Base fair time usage off of number of moves left
+  int moves_left = min(max(1, (empties - forceEgDepth) / 2), 18);
+  *allotment /= moves_left;
+  // Use up to 5x fair time
+  *limit = std::max(1, std::min(*allotment * 5, ms_left));
+}
 
+int Player::think(ArrayList &legal_moves, int time_allotment, int time_limit, bool infinite,
+  TimePoint move_start, SearchControl *parent, SearchControl *eg_parent) {
+  int empties = game.count_empty();
+  bool pondering = (parent == &ponderControl);
+  TimePoint hit_time;
+  lines.clear();
+  endgameSolver.stopControl = eg_parent;
 
   Eval e;
   init_evaluator(game, &e);
   int my_move = MOVE_BROKEN;
 
-  // Endgame solver: if we are within sight of the end and we have enough
-  // time to do a perfect solve (estimated by lastMaxDepth) or have unlimited
+  // The stages of a move share the hash tables: midgame iterations, then an
+  // exact solve, or selectivity iterations at full depth and a WLD
+  // confirmation. We solve if we are within sight of the end and the time
+  // manager predicts a perfect solve in our allotted time, or have unlimited
   // time. Always use endgame solver for the last forceEgDepth plies since it
-  // is faster and for more accurate results.
-  int eg_potential_depth = 4;
-  if (lastMaxDepth > forceEgDepth - 2)
-    eg_potential_depth -= (lastMaxDepth - forceEgDepth + 2) / 2;
-  if (empties <= endgameDepth
-   && (lastMaxDepth + eg_potential_depth >= empties || ms_left == -1 || empties <= forceEgDepth)) {
-    #if PRINT_SEARCH_INFO
-    cerr << "Endgame solver: depth " << empties << endl;
-    #endif
-
-    int eg_timeLimit = std::max(1, std::min(timeLimit - 40, 2 * time_allotment));
-    my_move = endgameSolver.solve_endgame(game, &e, mySide, legal_moves, false, empties, eg_timeLimit);
-
-    if (my_move != MOVE_BROKEN) {
-      game.do_move(mySide, my_move);
-      return my_move;
-    }
-    // Otherwise, we broke out of the endgame solver.
-    endgameDepth -= 2;
-    time_allotment = time_allotment / 2;
-    timeLimit -= eg_timeLimit;
-  }
+  // is faster and for more accurate results. The midgame iterations then sort
+  // the root moves for the solver, in place of its own sort searches.
+  bool solve = empties <= endgameDepth
+    && (timeManager.can_solve_endgame(empties, false, time_allotment) || infinite || empties <= forceEgDepth);
+  int sort_depth = endgameSolver.config.rootSortDepths[std::min(empties, EndgameConfig::DEPTHS - 1)];
+
+  // All stages run on one clock from the start of the move. A ponder search
+  // has its limit set on parent on the hit, and is timed from the hit.
+  uint64_t time_span = get_time_elapsed(move_start);
+  SearchControl search_control(parent);
+  search_control.start(pondering ? 0 : time_left(time_limit, time_span));
 
-  // Start timers
-  auto start_time = Clock::now();
-  timeElapsed = Clock::now();
-  uint64_t time_span = 0;
-
-  // Iterative deepening
   int root_depth = 1;
-  lastMaxDepth = 1;
-  int prev_best = MOVE_NULL, new_best = MOVE_NULL;
+  int last_depth = 1;
   int best_score = 0;
-  double time_adjustment_factor = 1.0;
 
   SearchInfo search_info;
-  search_info.root_age = turn;
+  search_info.root_age = 64 - empties;
   search_info.selectivity = baseSelectivity;
-  search_info.time_limit = timeLimit;
   search_info.tt = transpositionTable;
+  search_info.eval_cache = evalCache;
   search_info.other_heuristic = otherHeuristic;
-  search_info.search_start = timeElapsed;
-  do {
-    #if PRINT_SEARCH_INFO
-    cerr << "Depth " << root_depth << ": ";
-    #endif
+  search_info.control = &search_control;
+  while (true) {
+    // Iterative deepening, only to the sort depth before a solve
+    while ((root_depth == 1 || should_continue(time_span))
+        && (!solve || root_depth <= sort_depth)
+        && root_depth <= maxDepth
+        && last_depth < empties) {
+      #if PRINT_SEARCH_INFO
+      cerr << "Depth " << root_depth << ": ";
+      #endif
 
-    time_adjustment_factor = (2 * time_adjustment_factor + 1) / 3;
-    prev_best = new_best;
+      int prev_move = my_move;
+      uint64_t iter_nodes = search_info.nodes;
+      uint64_t iter_start = time_span;
+
+      int new_best = search_iteration(&e, legal_moves, root_depth, &best_score, &search_info);
+      if (new_best == MOVE_BROKEN) {
+        #if PRINT_SEARCH_INFO
+        cerr << " Broken out of search!" << endl;
+        #endif
+        time_span = get_time_elapsed(move_start);
+        break;
+      }
+      last_depth = root_depth;
+      root_depth++;
+      my_move = new_best;
+      time_span = get_time_elapsed(move_start);
+      timeManager.record_iteration(last_depth, search_info.nodes - iter_nodes,
+        time_span - iter_start, my_move != prev_move);
 
-    new_best = pvs_best_move(game, &e, mySide, legal_moves, &best_score, root_depth, &search_info);
-    if (new_best == MOVE_BROKEN) {
       #if PRINT_SEARCH_INFO
-      cerr << " Broken out of search!" << endl;
+      cerr << "time " << time_span
+           << " bestmove " << print_move(my_move)
+           << " score " << ((double) best_score) / EVAL_SCALE_FACTOR
+           << " nodes " << search_info.nodes << " nps " << 1000 * search_info.nodes / std::max((uint64_t) 1, time_span)
+           << " ebf " << timeManager.get_ebf()
+           << " pv " << print_pv(lines[0].pv) << endl;
       #endif
-      time_span = get_time_elapsed(start_time);
-      break;
-    }
-    lastMaxDepth = root_depth;
-
-    // Switch new PV to be searched first
-    legal_moves.swap(0, new_best);
-    root_depth++;
-    my_move = legal_moves.get(0);
-    time_span = get_time_elapsed(start_time);
-    if (new_best == prev_best) {
-      time_adjustment_factor *= 0.8;
-    } else {
-      if (time_adjustment_factor < 1.0) time_adjustment_factor = 1.0;
-      time_adjustment_factor *= 1.7;
-      if (time_adjustment_factor > 2.5) time_adjustment_factor = 2.5;
+    // Continue while we predict that we can finish the next depth within our
+    // allotted time for this move.
     }
+    if (!solve)
+      break;
 
     #if PRINT_SEARCH_INFO
-    cerr << "time " << time_span
-         << " bestmove " << print_move(my_move)
-         << " score " << ((double) best_score) / EVAL_SCALE_FACTOR
-         << " nodes " << search_info.nodes << " nps " << 1000 * search_info.nodes / time_span << endl;
+    cerr << "Endgame solver: depth " << empties << " predicted "
+         << timeManager.predict_endgame_ms(empties, false) << " ms" << endl;
     #endif
-  // Continue while we think we can finish the next depth within our
-  // allotted time for this move. Based on a crude estimate of branch factor.
-  } while (time_span < 0.85 * time_allotment * time_adjustment_factor
-        && root_depth <= maxDepth
-        && lastMaxDepth < empties);
+
+    // The solve gets what is left of the move's limit. A ponder solve before
+    // the hit gets its limit on eg_parent on the hit.
+    int eg_timeLimit = 0;
+    if (!pondering)
+      eg_timeLimit = eg_time_limit(time_allotment, time_left(time_limit, time_span));
+    else if (take_budget(&time_allotment, &time_limit, &hit_time))
+      eg_timeLimit = eg_time_limit(time_allotment,
+        time_left(time_limit, get_time_elapsed(hit_time)));
+    bool sorted = (root_depth > 1);
+    auto eg_start = Clock::now();
+    int solved;
+    if (multiPv > 1) {
+      std::vector<PVLine> eg_lines;
+      solved = endgameSolver.solve_multi_pv(game, &e, mySide, legal_moves, sorted, empties,
+        multiPv, eg_timeLimit, eg_lines);
+      if (solved != MOVE_BROKEN) {
+        my_move = legal_moves.get(0);
+        lines = eg_lines;
+      }
+    } else {
+      int score;
+      solved = sorted
+        ? endgameSolver.solve_endgame_sorted(game, &e, mySide, legal_moves, empties, best_score,
+            eg_timeLimit, &score)
+        : endgameSolver.solve_endgame(game, &e, mySide, legal_moves, false, empties,
+            eg_timeLimit, &score);
+      if (solved != MOVE_BROKEN) {
+        my_move = solved;
+        lines.assign(1, PVLine{score, endgameSolver.pv});
+      }
+    }
+    timeManager.record_endgame(empties, false, endgameSolver.nodes,
+      get_time_elapsed(eg_start), solved != MOVE_BROKEN);
+
+    if (solved != MOVE_BROKEN) {
+      for (unsigned int i = 0; i < lines.size(); i++)
+        lines[i].score *= EVAL_SCALE_FACTOR;
+      nodes = search_info.nodes + endgameSolver.nodes;
+      return my_move;
+    }
+    // Otherwise, we broke out of the endgame solver, and go on with the
+    // midgame iterations for half our allotment more, on the same clock and
+    // within the same limit.
+    time_span = get_time_elapsed(move_start);
+    uint64_t used = time_span;
+    if (pondering)
+      used = take_budget(&time_allotment, &time_limit, &hit_time) ? get_time_elapsed(hit_time) : 0;
+    if (!parent->stopped())
+      endgameDepth -= 2;
+    time_allotment = (int) used + time_allotment / 2;
+    timeManager.set_allotment(time_allotment);
+    solve = false;
+  }
 
   // Iterate selectivity
   int sel = 2;
-  while (lastMaxDepth >= empties
-   && time_span < 0.7 * time_allotment * time_adjustment_factor
+  while (last_depth >= empties
+   && should_continue(time_span)
    && sel < NO_SELECTIVITY) {
     #if PRINT_SEARCH_INFO
     cerr << "Selectivity " << sel << ": ";
     #endif
 
-    time_adjustment_factor = (2 * time_adjustment_factor + 1) / 3;
-    prev_best = new_best;
+    int prev_move = my_move;
+    uint64_t iter_nodes = search_info.nodes;
+    uint64_t iter_start = time_span;
 
     search_info.selectivity = sel;
-    new_best = pvs_best_move(game, &e, mySide, legal_moves, &best_score, root_depth, &search_info);
+    int new_best = search_iteration(&e, legal_moves, root_depth, &best_score, &search_info);
     if (new_best == MOVE_BROKEN) {
       #if PRINT_SEARCH_INFO
       cerr << " Broken out of search!" << endl;
       #endif
-      time_span = get_time_elapsed(start_time);
+      time_span = get_time_elapsed(move_start);
       break;
     }
-
-    // Switch new PV to be searched first
-    legal_moves.swap(0, new_best);
     sel++;
-    my_move = legal_moves.get(0);
-    time_span = get_time_elapsed(start_time);
-    if (new_best == prev_best) {
-      time_adjustment_factor *= 0.8;
-    } else {
-      if (time_adjustment_factor < 1.0) time_adjustment_factor = 1.0;
-      time_adjustment_factor *= 1.7;
-      if (time_adjustment_factor > 2.5) time_adjustment_factor = 2.5;
-    }
+    my_move = new_best;
+    time_span = get_time_elapsed(move_start);
+    timeManager.record_iteration(root_depth, search_info.nodes - iter_nodes,
+      time_span - iter_start, my_move != prev_move);
 
     #if PRINT_SEARCH_INFO
     cerr << "time " << time_span
          << " bestmove " << print_move(my_move)
          << " score " << ((double) best_score) / EVAL_SCALE_FACTOR
-         << " nodes " << search_info.nodes << " nps " << 1000 * search_info.nodes / time_span << endl;
+         << " nodes " << search_info.nodes << " nps " << 1000 * search_info.nodes / time_span
+         << " pv " << print_pv(lines[0].pv) << endl;
     #endif
   }
 
-  lastMaxDepth += sel - 2;
-  lastMaxDepth += 0.5 - log(time_adjustment_factor) / log(1.4);
-  if (sel >= NO_SELECTIVITY) lastMaxDepth += 4;
   // The best move should be at the front of the list.
   my_move = legal_moves.get(0);
+  nodes = search_info.nodes;
+  evalProbes = search_info.eval_probes;
+  evalHits = search_info.eval_hits;
+
+  // A ponder search that ran out of iterations waits for the hit, and then
+  // counts the time of the move from the hit on.
+  uint64_t move_ms = time_span;
+  if (pondering) {
+    wait_for_hit();
+    if (!take_budget(&time_allotment, &time_limit, &hit_time))
+      return my_move;
+    move_ms = get_time_elapsed(hit_time);
+  }
 
-  // WLD confirmation at high depths
-  int wld_potential_depth = 6;
-  if (lastMaxDepth > forceEgDepth - 2)
-    wld_potential_depth -= (lastMaxDepth - forceEgDepth + 2) / 2;
+  // WLD confirmation, if the time manager predicts it fits in what remains of
+  // our allotted time.
+  int budget = (time_limit == 0) ? time_allotment : std::min(time_limit, time_allotment);
+  uint64_t wld_budget = (uint64_t) budget > move_ms ? budget - move_ms : 0;
   if (empties <= endgameDepth + 2
-  && (lastMaxDepth + wld_potential_depth >= empties || ms_left == -1)
-  && empties > forceEgDepth
-  && time_span < (uint64_t) 3 * std::min(timeLimit, time_allotment) / 4) {
+  && (timeManager.can_solve_endgame(empties, true, wld_budget) || infinite)
+  && empties > forceEgDepth) {
+    auto wld_start = Clock::now();
+    int wld_limit = (time_limit == 0) ? time_allotment
+      : std::min(time_allotment, time_left(time_limit, move_ms));
     int WLDMove = endgameSolver.solve_wld(game, &e, mySide, legal_moves, true,
-      empties, time_allotment);
+      empties, wld_limit);
+    timeManager.record_endgame(empties, true, endgameSolver.nodes,
+      get_time_elapsed(wld_start), WLDMove != MOVE_BROKEN);
 
     if (WLDMove != MOVE_BROKEN) {
       if (WLDMove != -1 && my_move != WLDMove) {
@@ -274,38 +432,380 @@ int Player::do_move(int opponents_move, int ms_left) {
         my_move = WLDMove;
       }
     }
-    // If we broke out of WLD here next move's endgame solver isn't likely
-    // to be successful...
-    else {
-      lastMaxDepth -= 4;
-    }
   }
 
-  time_span = get_time_elapsed(start_time);
+  time_span = get_time_elapsed(move_start);
   #if PRINT_SEARCH_INFO
   cerr << "Total time: " << time_span / 1000.0 << " s" << endl;
   cerr << "Nodes: " << search_info.nodes << " | NPS: " << 1000 * search_info.nodes / time_span << endl;
   cerr << "Hashfull: " << transpositionTable->hash_full() << endl;
+  if (search_info.eval_probes > 0) {
+    cerr << "Eval cache hits: " << 100.0 * search_info.eval_hits / search_info.eval_probes
+         << "%" << endl;
+  }
   cerr << "Playing " << print_move(my_move) << ". Score: " << ((double) best_score) / EVAL_SCALE_FACTOR << endl << endl;
   #endif
 
-  nodes = search_info.nodes;
-  game.do_move(mySide, my_move);
-
   return my_move;
 }
 
+bool Player::should_continue(uint64_t time_span) {
+  if (!ponderSearch)
+    return timeManager.should_start_iteration(time_span);
+  // A ponder search deepens until the hit, and is then timed from it
+  int allotment, limit;
+  TimePoint hit_time;
+  if (!take_budget(&allotment, &limit, &hit_time))
+    return !ponderControl.stopped();
+  return timeManager.should_start_iteration(get_time_elapsed(hit_time));
+}
+
+bool Player::take_budget(int *allotment, int *limit, TimePoint *hit_time) {
+  std::lock_guard<std::mutex> lock(ponderLock);
+  if (!ponderHit)
+    return false;
+  *allotment = hitAllotment;
+  *limit = hitLimit;
+  *hit_time = ponderHitTime;
+  if (!budgetTaken) {
+    timeManager.set_budget(hitAllotment, hitLimit);
+    budgetTaken = true;
+  }
+  return true;
+}
+
+void Player::wait_for_hit() {
+  std::unique_lock<std::mutex> lock(ponderLock);
+  // Polled, since a stop() of the parent control does not notify
+  while (!ponderHit && !ponderControl.stopped())
+    ponderWake.wait_for(lock, std::chrono::milliseconds(10));
+}
+
+void Player::stop() {
+  control.stop();
+}
+
+void Player::clear_stop() {
+  control.start(0);
+}
+
+AnalysisResult Player::analyze(int max_depth, uint64_t ms, uint64_t max_nodes) {
+  auto start_time = Clock::now();
+  AnalysisResult result;
+  result.best_move = MOVE_NULL;
+  result.depth = 0;
+  result.nodes = 0;
+  lines.clear();
+
+  ArrayList legal_moves = game.legal_movelist(mySide);
+  int empties = game.count_empty();
+  if (legal_moves.size() > 0) {
+    result.best_move = MOVE_BROKEN;
+    if (max_depth <= 0 || max_depth > empties)
+      max_depth = empties;
+
+    Eval e;
+    init_evaluator(game, &e);
+    SearchControl search_control(&control);
+    search_control.start(ms);
+
+    SearchInfo search_info;
+    search_info.root_age = 64 - empties;
+    search_info.selectivity = baseSelectivity;
+    search_info.tt = transpositionTable;
+    search_info.eval_cache = evalCache;
+    search_info.other_heuristic = otherHeuristic;
+    search_info.control = &search_control;
+    if (max_nodes > 0)
+      search_info.node_limit = max_nodes;
+
+    int best_score = 0;
+    for (int depth = 1; depth <= max_depth; depth++) {
+      int best = search_iteration(&e, legal_moves, depth, &best_score, &search_info);
+      if (best == MOVE_BROKEN)
+        break;
+      result.best_move = best;
+      result.depth = depth;
+    }
+    result.nodes = search_info.nodes;
+  }
+
+  nodes = result.nodes;
+  result.lines = lines;
+  result.ms = get_time_elapsed(start_time);
+  return result;
+}
+
+AnalysisResult Player::solve(bool wld, uint64_t ms) {
+  auto start_time = Clock::now();
+  AnalysisResult result;
+  result.best_move = MOVE_NULL;
+  result.depth = game.count_empty();
+  result.nodes = 0;
+  lines.clear();
+
+  ArrayList legal_moves = game.legal_movelist(mySide);
+  if (legal_moves.size() > 0) {
+    result.best_move = MOVE_BROKEN;
+    Eval e;
+    init_evaluator(game, &e);
+    if (multiPv > 1 && !wld) {
+      if (endgameSolver.solve_multi_pv(game, &e, mySide, legal_moves, false, result.depth,
+          multiPv, (int) ms, lines) != MOVE_BROKEN)
+        result.best_move = legal_moves.get(0);
+    } else {
+      int score;
+      int best = wld
+        ? endgameSolver.solve_wld(game, &e, mySide, legal_moves, false, result.depth, (int) ms, &score)
+        : endgameSolver.solve_endgame(game, &e, mySide, legal_moves, false, result.depth, (int) ms, &score);
+      if (best != MOVE_BROKEN) {
+        // A WLD solve gives no move if every move loses
+        result.best_move = (best == -1) ? legal_moves.get(0) : best;
+        lines.push_back(PVLine{score, endgameSolver.pv});
+        if (lines[0].pv.empty())
+          lines[0].pv.push_back(result.best_move);
+      }
+    }
+    result.nodes = endgameSolver.nodes;
+  }
+
+  nodes = result.nodes;
+  result.lines = lines;
+  result.ms = get_time_elapsed(start_time);
+  return result;
+}
+
 void Player::set_depths(int max, int end) {
   maxDepth = max;
   endgameDepth = end;
 }
 
+void Player::set_threads(int threads) {
+  endgameSolver.threads = std::max(1, threads);
+}
+
+void Player::set_time_log(const std::string &file) {
+  timeManager.set_log(file);
+}
+
+void Player::set_hash_mb(uint64_t mb) {
+  uint64_t bytes = mb << 20;
+  // A quarter had the fewest nodes of the splits tried (1/8 to 3/4) on
+  // solves of 19-22 empties and depth 14 searches, at 16 and 128 MB.
+  transpositionTable->resize_bytes(bytes / 4);
+  resize_endhash_bytes(bytes - bytes / 4);
+}
+
+void Player::print_hash_memory(std::ostream &out) {
+  out << "Hash memory: midgame " << transpositionTable->bytes() / 1024 << " KB | ";
+  print_endhash_memory(out);
+  out << std::endl;
+}
+
 uint64_t Player::get_nodes() {
   return nodes;
 }
 
+uint64_t Player::get_eval_probes() {
+  return evalProbes;
+}
+
+uint64_t Player::get_eval_hits() {
+  return evalHits;
+}
+
+const std::vector<PVLine> &Player::get_lines() {
+  return lines;
+}
+
 void Player::set_position(uint64_t taken_bits, uint64_t black_bits) {
+  stop_pondering(MOVE_NULL);
   game = Board(taken_bits & ~black_bits, black_bits);
   bookExhausted = true;
   turn = 64 - game.count_empty();
 }
+
+int Player::search_iteration(Eval *e, ArrayList &moves, int depth, int *best_score,
+  SearchInfo *search_info) {
+  if (multiPv > 1) {
+    std::vector<PVLine> iter_lines;
+    if (pvs_multi_pv(game, e, mySide, moves, multiPv, depth, search_info, iter_lines) == MOVE_BROKEN)
+      return MOVE_BROKEN;
+    *best_score = iter_lines[0].score;
+    lines = iter_lines;
+    return moves.get(0);
+  }
+
+  // Aspiration window around the scores of the last two iterations, which
+  // evens out the swing between odd and even depths. The window is widened
+  // on each fail high or fail low.
+  int window = ASPIRATION_WINDOW;
+  int alpha = -INFTY;
+  int beta = INFTY;
+  if (depth >= ASPIRATION_DEPTH) {
+    int center = (*best_score + prevIterScore) / 2;
+    alpha = center - window;
+    beta = center + window;
+  }
+  std::vector<uint64_t> move_nodes;
+  int best, score;
+  while (true) {
+    best = pvs_root(game, e, mySide, moves, &score, depth, alpha, beta, search_info, &move_nodes);
+    if (best == MOVE_BROKEN)
+      return MOVE_BROKEN;
+    if (score <= alpha && alpha > -INFTY) {
+      window *= 2;
+      alpha = std::max(score - window, -INFTY);
+    } else if (score >= beta && beta < INFTY) {
+      window *= 2;
+      beta = std::min(score + window, INFTY);
+      // Search the cut move first, it is the best we have right now
+      moves.swap(0, best);
+      std::swap(move_nodes[0], move_nodes[best]);
+    } else {
+      break;
+    }
+  }
+  prevIterScore = *best_score;
+  *best_score = score;
+
+  // Switch new PV to be searched first. Order the other moves by the nodes
+  // they took, since the moves that were hardest to refute are the most
+  // likely to become the best.
+  moves.swap(0, best);
+  std::swap(move_nodes[0], move_nodes[best]);
+  for (int i = 2; i < moves.size(); i++) {
+    for (int j = i; j > 1 && move_nodes[j] > move_nodes[j-1]; j--) {
+      moves.swap(j, j-1);
+      std::swap(move_nodes[j], move_nodes[j-1]);
+    }
+  }
+  lines.assign(1, PVLine{*best_score, hash_pv(game, mySide, moves.get(0), depth, transpositionTable)});
+  return moves.get(0);
+}
+
+void Player::start_pondering() {
+  stop_pondering(MOVE_NULL);
+  if (game.count_empty() == 0)
+    return;
+
+  // Predict the reply from the hash table, if our search stored one
+  ponderMove = MOVE_NULL;
+  HashEntry entry;
+  if (transpositionTable->get(game, ~mySide, &entry) && entry.nodeType != ALL_NODE
+   && entry.move < 64 && (game.legal_moves(~mySide) & (1ULL << entry.move)))
+    ponderMove = entry.move;
+
+  ponderControl.start(0);
+  ponderEgControl.start(0);
+  ponderHit = false;
+  budgetTaken = false;
+  ponderResult = MOVE_BROKEN;
+  ponderStart = Clock::now();
+  if (ponderMove != MOVE_NULL) {
+    Board b = game.copy();
+    b.do_move(~mySide, ponderMove);
+    ArrayList moves = b.legal_movelist(mySide);
+    // do_move() does not search book moves, or with one legal move or none
+    bool book = !bookExhausted && openingBook->get(b, mySide) != OPENING_NOT_FOUND;
+    if (moves.size() > 1 && !book) {
+      ponderBase = game;
+      game = b;
+      int empties = game.count_empty();
+      turn = 64 - empties;
+      int time_allotment, time_limit;
+      allot_time(empties, lastMsLeft, &time_allotment, &time_limit);
+      timeManager.start_move(empties, time_allotment, time_limit);
+      ponderSearch = true;
+      ponderThread = std::thread(&Player::ponder_move, this, moves, time_allotment, time_limit,
+        lastMsLeft == -1);
+      pondersPredicted++;
+      return;
+    }
+    ponderMove = MOVE_NULL;
+  }
+  ponderThread = std::thread(&Player::ponder, this, game.copy(), ~mySide);
+  pondersAll++;
+}
+
+void Player::stop_pondering(int opponents_move) {
+  if (!ponderThread.joinable())
+    return;
+  ponderControl.stop();
+  ponderWake.notify_one();
+  ponderThread.join();
+  endgameSolver.stopControl = &control;
+  if (ponderSearch) {
+    game = ponderBase;
+    turn = 64 - game.count_empty();
+    ponderSearch = false;
+  }
+  #if PRINT_SEARCH_INFO
+  cerr << "Pondered " << get_time_elapsed(ponderStart) << " ms on "
+       << (ponderMove == MOVE_NULL ? "all replies" : print_move(ponderMove))
+       << (opponents_move != MOVE_NULL && ponderMove != MOVE_NULL ? " (miss)" : "") << endl;
+  #endif
+}
+
+std::string Player::ponder_stats() {
+  std::string result = "Ponder hits: " + std::to_string(ponderHits) + " / "
+    + std::to_string(pondersPredicted) + " predicted";
+  if (pondersPredicted > 0)
+    result += " (" + std::to_string(100 * ponderHits / pondersPredicted) + "%)";
+  result += ", " + std::to_string(pondersAll) + " on all replies"
+    + " | Time saved on hits: " + std::to_string(ponderSavedMs) + " of "
+    + std::to_string(ponderAllottedMs) + " ms allotted";
+  return result;
+}
+
+// The ponder search on a predicted reply, which plays on in do_move() after
+// a ponder hit.
+void Player::ponder_move(ArrayList moves, int time_allotment, int time_limit, bool infinite) {
+  ponderResult = think(moves, time_allotment, time_limit, infinite, Clock::now(),
+    &ponderControl, &ponderEgControl);
+}
+
+// Iterative deepening on the given position until stopped, or in endgame
+// range exact solves of each reply. The results are kept only in the hash
+// tables, for the next call to do_move().
+void Player::ponder(Board b, Color c) {
+  ArrayList moves = b.legal_movelist(c);
+  if (moves.size() == 0)
+    return;
+
+  if (b.count_empty() - 1 <= forceEgDepth) {
+    endgameSolver.stopControl = &ponderEgControl;
+    for (int i = 0; i < moves.size() && !ponderControl.stopped(); i++) {
+      Board reply = b.copy();
+      reply.do_move(c, moves.get(i));
+      ArrayList replies = reply.legal_movelist(~c);
+      if (replies.size() == 0)
+        continue;
+      Eval e;
+      init_evaluator(reply, &e);
+      int score;
+      endgameSolver.solve_endgame(reply, &e, ~c, replies, false, reply.count_empty(), 0, &score);
+    }
+    return;
+  }
+
+  Eval e;
+  init_evaluator(b, &e);
+
+  SearchInfo search_info;
+  search_info.root_age = 64 - b.count_empty();
+  search_info.selectivity = baseSelectivity;
+  search_info.tt = transpositionTable;
+  search_info.eval_cache = evalCache;
+  search_info.other_heuristic = otherHeuristic;
+  search_info.control = &ponderControl;
+
+  int best_score;
+  int max_depth = std::min(maxDepth, b.count_empty());
+  for (int depth = 1; depth <= max_depth && !ponderControl.stopped(); depth++) {
+    int best = pvs_best_move(b, &e, c, moves, &best_score, depth, &search_info);
+    if (best == MOVE_BROKEN)
+      break;
+    moves.swap(0, best);
+  }
+}
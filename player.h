@@ -1,12 +1,34 @@
 #ifndef __PLAYER_H__
 #define __PLAYER_H__
 
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
 #include "board.h"
 #include "common.h"
 #include "endgame.h"
 #include "hash.h"
 #include "openings.h"
 #include "search.h"
+#include "searchcontrol.h"
+#include "timeman.h"
+
+// The result of Player::analyze() or Player::solve().
+struct AnalysisResult {
+  // MOVE_NULL if there is no legal move, or MOVE_BROKEN if stopped before
+  // any result
+  int best_move;
+  // Depth of the last completed iteration, or the empties for a solve
+  int depth;
+  uint64_t nodes;
+  uint64_t ms;
+  // The best lines, best first. Midgame scores are in eval units and solve
+  // scores in discs. WLD scores are only right in sign.
+  std::vector<PVLine> lines;
+};
 
 class Player {
  public:
@@ -14,36 +36,132 @@ class Player {
   Color mySide;
   bool otherHeuristic;
   Hash *transpositionTable;
+  EvalCache *evalCache;
   int turn;
   int baseSelectivity;
   int bufferPerMove;
+  // Number of best moves to search exactly, for analysis
+  int multiPv;
 
   Player(Color side, bool use_book, int tt_bits);
   ~Player();
 
   // Processes opponent's last move and selects a best move to play.
   int do_move(int opponents_move, int ms_left);
+  // Stops the current search, which then returns its best move so far. Safe
+  // to call from another thread, for example on a protocol stop command.
+  void stop();
+  // Lets searches run again after stop(). do_move() does this itself, but a
+  // protocol thread that starts searches on another thread must call this
+  // before starting one, so that an early stop() is not lost.
+  void clear_stop();
+
+  // Analyzes the position in game for mySide, without playing a move. Limits
+  // of 0 mean no limit. The search also ends at full depth or on stop().
+  AnalysisResult analyze(int max_depth, uint64_t ms, uint64_t max_nodes);
+  // Solves the position in game for mySide exactly, or for win/loss/draw.
+  AnalysisResult solve(bool wld, uint64_t ms);
   void set_depths(int max, int end);
+  // Sets the number of threads for endgame and WLD solves.
+  void set_threads(int threads);
+  // Appends the time manager's records to the given file, for timereplay.
+  void set_time_log(const std::string &file);
+  // Splits a memory budget in MB between the hash tables: a quarter for the
+  // midgame table, which the solver's sort searches also use, and the rest
+  // for the endgame PV, cut and all tables. These are shared by all Players.
+  void set_hash_mb(uint64_t mb);
+  // Prints the size of the midgame and endgame hash tables.
+  void print_hash_memory(std::ostream &out);
   uint64_t get_nodes();
+  // Probes and hits of the evaluation cache in the last do_move() search
+  uint64_t get_eval_probes();
+  uint64_t get_eval_hits();
+  // The best lines found by the last do_move(), best first, with one line
+  // unless multiPv is set. Scores are in eval units, also for solved
+  // positions, which are exact to the disc.
+  const std::vector<PVLine> &get_lines();
   void set_position(uint64_t taken_bits, uint64_t black_bits);
 
+  // Searches on the opponent's time, after our move has been sent. If the
+  // hash table predicts the reply, the position after it is searched as
+  // do_move() would, and on a ponder hit the search keeps running on the time
+  // of the move. Otherwise all replies are searched to fill the hash tables.
+  void start_pondering();
+  // Stops pondering after a miss, or without a reply.
+  void stop_pondering(int opponents_move);
+  std::string ponder_stats();
+
  private:
   int maxDepth;
   int endgameDepth;
   // Always use the endgame solver with this many empty squares left, since it is faster.
   int forceEgDepth;
-  // The last max depth achieved, for entering endgame solver
-  int lastMaxDepth;
 
+  // The score of the search iteration before the last, for aspiration windows
+  int prevIterScore;
   uint64_t nodes;
+  uint64_t evalProbes;
+  uint64_t evalHits;
+  std::vector<PVLine> lines;
 
   Endgame endgameSolver;
+  TimeManager timeManager;
 
   Openings *openingBook;
   bool bookExhausted;
 
-  int timeLimit;
-  TimePoint timeElapsed;
+  // Our time left after our last move, to budget a ponder search, or -1
+  int lastMsLeft;
+  // Parent of the controls of every search this player runs
+  SearchControl control;
+
+  std::thread ponderThread;
+  SearchControl ponderControl;
+  // Stops the exact solves of a ponder search, which get their own limit on
+  // a ponder hit
+  SearchControl ponderEgControl;
+  // The predicted reply being pondered, or MOVE_NULL for all replies
+  int ponderMove;
+  // Whether the ponder thread searches the predicted position as do_move()
+  // would. game is then the position after the reply, and ponderBase the
+  // position before it, restored on a miss.
+  bool ponderSearch;
+  Board ponderBase;
+  int ponderResult;
+  TimePoint ponderStart;
+  // Handoff of the move's time from do_move() to the ponder search on a hit
+  std::mutex ponderLock;
+  std::condition_variable ponderWake;
+  bool ponderHit, budgetTaken;
+  TimePoint ponderHitTime;
+  int hitAllotment, hitLimit;
+  // Ponder statistics: number of ponders with a predicted reply, how many of
+  // those predicted correctly, and on those hits the time allotted to the
+  // move and the part of it that was not needed.
+  int pondersPredicted, ponderHits, pondersAll;
+  uint64_t ponderAllottedMs, ponderSavedMs;
+
+  // Splits ms_left into the fair time for a move with the given empties and
+  // a hard limit, which is 0 with no clock (ms_left -1).
+  void allot_time(int empties, int ms_left, int *allotment, int *limit);
+  // Picks the move to play in game from legal_moves, with an exact solve,
+  // the midgame search and a WLD confirmation as time allows, all timed from
+  // move_start. The searches stop with parent, and the solves with eg_parent.
+  int think(ArrayList &legal_moves, int time_allotment, int time_limit, bool infinite,
+    TimePoint move_start, SearchControl *parent, SearchControl *eg_parent);
+  // Whether think() should start another iteration
+  bool should_continue(uint64_t time_span);
+  // For a ponder search after the hit, replaces the predicted budget with the
+  // move's and gives the time of the hit. Returns false before the hit.
+  bool take_budget(int *allotment, int *limit, TimePoint *hit_time);
+  // Blocks a ponder search until the hit, or until it is stopped.
+  void wait_for_hit();
+  // Runs one iteration of the midgame search, which moves the best move to
+  // the front of moves and updates lines. Returns the best move, or
+  // MOVE_BROKEN if the search was stopped.
+  int search_iteration(Eval *e, ArrayList &moves, int depth, int *best_score, SearchInfo *search_info);
+  void ponder_move(ArrayList moves, int time_allotment, int time_limit, bool infinite);
+  void ponder(Board b, Color c);
 };
 
 #endif
@@ -1,68 +1,182 @@
+#include <atomic>
 #include <iostream>
 #include <cstdlib>
 #include <cstring>
+#include <mutex>
 #include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 #include "eval.h"
 #include "player.h"
 using namespace std;
 
+// Protocol for the python wrapper. After isready, reads one command per line:
+//   [x] [y] [ms]               the opponent's move, -1 -1 for none, and our
+//                              time left. Answered with our move and the
+//                              disc counts.
+//   stop                       plays the best move found so far
+//   position [taken] [black]   abandons the search, and sets the position
+//   quit
+// Moves are searched on their own thread, so that the other commands are read
+// while a search runs.
+
+namespace {
+
+mutex outputLock;
+
+void send(const string &line) {
+  lock_guard<mutex> lock(outputLock);
+  cout << line << endl;
+}
+
+void set_position(Player *player, const string &taken, const string &black) {
+  uint64_t taken_bits, black_bits;
+  std::stringstream ss;
+  ss << std::hex << taken;
+  ss >> taken_bits;
+  ss.str("");
+  ss.clear();
+  ss << std::hex << black;
+  ss >> black_bits;
+  player->set_position(taken_bits, black_bits);
+}
+
+}  // namespace
+
 int main(int argc, char *argv[]) {
   // Read in side the player is on.
   if (argc < 2)  {
-    cerr << "usage: " << argv[0] << " side [startpos]" << endl;
+    cerr << "usage: " << argv[0] << " side [taken black] [-t threads] [-l timelog] [-p]"
+         << " [--hash-mb mb]" << endl;
     exit(-1);
   }
   Color side = (!strcmp(argv[1], "black")) ? BLACK : WHITE;
 
+  // Separate the options from the positional arguments.
+  int threads = 1;
+  string time_log;
+  bool ponder = false;
+  uint64_t hash_mb = 0;
+  vector<string> args;
+  for (int i = 2; i < argc; i++) {
+    if (!strcmp(argv[i], "-t") && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+      time_log = argv[++i];
+    else if (!strcmp(argv[i], "-p"))
+      ponder = true;
+    else if (!strcmp(argv[i], "--hash-mb") && i + 1 < argc)
+      hash_mb = strtoull(argv[++i], nullptr, 10);
+    else
+      args.push_back(argv[i]);
+  }
+
   // Initialize player.
   init_eval();
   Player *player = new Player(side, false, /*tt_bits=*/16);
-  resize_endhash(10);
+  player->set_threads(threads);
+  if (!time_log.empty())
+    player->set_time_log(time_log);
+  if (hash_mb > 0)
+    player->set_hash_mb(hash_mb);
+  else
+    resize_endhash(10);
+  player->print_hash_memory(cerr);
 
   // If an opening position is given:
-  if (argc == 4) {
-    uint64_t taken_bits, black_bits;
-    std::stringstream ss;
-    ss << std::hex << argv[2];
-    ss >> taken_bits;
-    ss.str("");
-    ss.clear();
-    ss << std::hex << argv[3];
-    ss >> black_bits;
-    player->set_position(taken_bits, black_bits);
-  }
+  if (args.size() == 2)
+    set_position(player, args[0], args[1]);
 
   // Send ready signal
   std::string rstr;
   while (true) {
     cin >> rstr;
     if (rstr.compare("isready") == 0) {
-      cout << "ready" << endl;
-      cout.flush();
+      send("ready");
       break;
     }
   }
-  
-  int moveX, moveY, msLeft;
 
-  // Get opponent's move and time left for player each turn.
-  while (cin >> moveX >> moveY >> msLeft) {
+  thread search;
+  // Whether do_move() is running, so that a stop does not reach the ponder search
+  atomic<bool> searching(false);
+  // Set when the search is abandoned, and its move not sent
+  atomic<bool> abandoned(false);
+  string line;
+  while (getline(cin, line)) {
+    stringstream ss(line);
+    string command;
+    if (!(ss >> command))
+      continue;
+
+    if (command == "stop") {
+      if (searching)
+        player->stop();
+      continue;
+    }
+    if (command == "isready") {
+      send("ready");
+      continue;
+    }
+    if (command == "quit" || command == "position") {
+      abandoned = true;
+      player->stop();
+    }
+    // Everything else waits for the running search, if any
+    if (search.joinable())
+      search.join();
+    abandoned = false;
+
+    if (command == "quit") {
+      break;
+    } else if (command == "position") {
+      string taken, black;
+      if (ss >> taken >> black)
+        set_position(player, taken, black);
+      else
+        cerr << "Bad position: " << line << endl;
+      continue;
+    }
+
+    int moveX, moveY, msLeft;
+    stringstream move_ss(line);
+    if (!(move_ss >> moveX >> moveY >> msLeft)) {
+      cerr << "Unknown command: " << line << endl;
+      continue;
+    }
     int opponentsMove = MOVE_NULL;
     if (moveX >= 0 && moveY >= 0) {
       opponentsMove = move_xy(moveX, moveY);
     }
-    
-    // Get player's move and output to python wrapper.
-    int playersMove = player->do_move(opponentsMove, msLeft);
-    if (playersMove != MOVE_NULL) {
-      cout << move_col(playersMove) << " " << move_row(playersMove) << " "
-         << player->game.count(BLACK) << " " << player->game.count(WHITE) << endl;
-    } else {
-      cout << "-1 -1 " << player->game.count(BLACK) << " " << player->game.count(WHITE) << endl;
-    }
-    cout.flush();
-    cerr.flush();
+
+    player->clear_stop();
+    searching = true;
+    search = thread([player, opponentsMove, msLeft, ponder, &searching, &abandoned]() {
+      // Get player's move and output to python wrapper.
+      int playersMove = player->do_move(opponentsMove, msLeft);
+      searching = false;
+      if (abandoned)
+        return;
+      std::stringstream out;
+      if (playersMove != MOVE_NULL)
+        out << move_col(playersMove) << " " << move_row(playersMove) << " ";
+      else
+        out << "-1 -1 ";
+      out << player->game.count(BLACK) << " " << player->game.count(WHITE);
+      send(out.str());
+      cerr.flush();
+
+      // Search on the opponent's time while we wait for their move.
+      if (ponder)
+        player->start_pondering();
+    });
   }
 
+  if (search.joinable())
+    search.join();
+  player->stop_pondering(MOVE_NULL);
+  if (ponder)
+    cerr << player->ponder_stats() << endl;
   return 0;
 }
@@ -22,82 +22,56 @@ constexpr int SELECTIVITY_FACTOR[6] = {0,
   1, 2, 4, 7, 11
 };
 
+// Depths up to this are searched by the depth-specialized pvs_shallow<>.
+// Static eval margins are only defined up to depth 3.
+constexpr int PVS_SHALLOW_DEPTH = 2;
+static_assert(PVS_SHALLOW_DEPTH >= 1 && PVS_SHALLOW_DEPTH <= 3, "no static eval margin for PVS_SHALLOW_DEPTH");
+
 int static_eval_margin(int bound_type, int depth, int selectivity) {
   return STATIC_EVAL_MARGIN[bound_type][depth] * (3 + selectivity) / 4;
 }
 
-int pvs_0(Board& b, Eval* e, Color c, SearchInfo* search_info) {
+// Shallow searches, specialized on depth at compile time so that each level
+// calls the next directly and the whole chain can be inlined.
+template <int depth>
+int pvs_shallow(Board &b, Eval* e, Color c, int alpha, int beta, bool passed_last, SearchInfo* search_info);
+
+template <>
+int pvs_shallow<0>(Board &b, Eval* e, Color c, int alpha, int beta, bool passed_last, SearchInfo* search_info) {
   return heuristic(b, e, c);
 }
 
-int pvs_1(Board &b, Eval* e, Color c, int alpha, int beta, bool passed_last, SearchInfo* search_info) {
+template <int depth>
+int pvs_shallow(Board &b, Eval* e, Color c, int alpha, int beta, bool passed_last, SearchInfo* search_info) {
   // Static eval pruning
   if (alpha == beta - 1
    && search_info->selectivity < NO_SELECTIVITY) {
-    int static_eval = pvs_0(b, e, c, search_info);
-    if (static_eval >= beta + static_eval_margin(BETA_BOUND, 1, SELECTIVITY_FACTOR[search_info->selectivity]))
+    int static_eval = heuristic(b, e, c);
+    if (static_eval >= beta + static_eval_margin(BETA_BOUND, depth, SELECTIVITY_FACTOR[search_info->selectivity]))
       return beta;
-    if (static_eval < alpha - static_eval_margin(ALPHA_BOUND, 1, SELECTIVITY_FACTOR[search_info->selectivity]))
+    if (static_eval < alpha - static_eval_margin(ALPHA_BOUND, depth, SELECTIVITY_FACTOR[search_info->selectivity]))
       return alpha;
   }
 
-  ArrayList legalMoves = b.legal_movelist(c);
-  if (legalMoves.size() <= 0) {
+  uint64_t legal = b.legal_moves(c);
+  if (!legal) {
     if (passed_last)
       return score_game_end(b, c);
 
-    return -pvs_1(b, e, ~c, -beta, -alpha, true, search_info);
-  }
-
-  int bestScore = -INFTY;
-  for (int i = 0; i < legalMoves.size(); i++) {
-    int m = legalMoves.get(i);
-    Board copy = b.copy();
-    Eval ec = *e;
-    uint64_t mask = copy.get_do_move(c, m);
-    ec.update(c, m, mask);
-    copy.do_move(c, m, mask);
-    search_info->nodes++;
-
-    int score = -pvs_0(copy, &ec, ~c, search_info);
-
-    if (score >= beta)
-      return score;
-    if (score > bestScore)
-      bestScore = score;
-  }
-
-  return bestScore;
-}
-
-int pvs_2(Board &b, Eval* e, Color c, int alpha, int beta, bool passed_last, SearchInfo* search_info) {
-  // Static eval pruning
-  if (alpha == beta - 1
-   && search_info->selectivity < NO_SELECTIVITY) {
-    int static_eval = pvs_0(b, e, c, search_info);
-    if (static_eval >= beta + static_eval_margin(BETA_BOUND, 2, SELECTIVITY_FACTOR[search_info->selectivity]))
-      return beta;
-    if (static_eval < alpha - static_eval_margin(ALPHA_BOUND, 2, SELECTIVITY_FACTOR[search_info->selectivity]))
-      return alpha;
+    return -pvs_shallow<depth>(b, e, ~c, -beta, -alpha, true, search_info);
   }
 
-  ArrayList legalMoves = b.legal_movelist(c);
-  if (legalMoves.size() <= 0) {
-    if (passed_last)
-      return score_game_end(b, c);
-
-    return -pvs_2(b, e, ~c, -beta, -alpha, true, search_info);
+  // Move ordering with piece square table. At depth 1 the children are static
+  // evaluations, so ordering is not worth the cost.
+  MoveList moves(legal);
+  if (depth >= 2) {
+    for (int i = 0; i < moves.size(); i++)
+      moves.set_score(i, SQ_VAL[moves.move(i)]);
   }
 
-  // Move ordering with piece square table
-  ArrayList scores;
-  for (int i = 0; i < legalMoves.size(); i++)
-    scores.add(SQ_VAL[legalMoves.get(i)]);
-
   int bestScore = -INFTY;
-  int i = 0;
-  for (int m = next_move(legalMoves, scores, i); m != MOVE_NULL;
-           m = next_move(legalMoves, scores, ++i)) {
+  for (int i = 0; i < moves.size(); i++) {
+    int m = (depth >= 2) ? moves.next(i) : moves.move(i);
     Board copy = b.copy();
     Eval ec = *e;
     uint64_t mask = copy.get_do_move(c, m);
@@ -105,7 +79,7 @@ int pvs_2(Board &b, Eval* e, Color c, int alpha, int beta, bool passed_last, Sea
     copy.do_move(c, m, mask);
     search_info->nodes++;
 
-    int score = -pvs_1(copy, &ec, ~c, -beta, -alpha, false, search_info);
+    int score = -pvs_shallow<depth-1>(copy, &ec, ~c, -beta, -alpha, false, search_info);
 
     if (score >= beta)
       return score;
@@ -120,11 +94,31 @@ int pvs_2(Board &b, Eval* e, Color c, int alpha, int beta, bool passed_last, Sea
   return bestScore;
 }
 
-int pvs_deep(Board &b, Eval* e, Color c, int depth, int alpha, int beta, bool passed_last, SearchInfo* search_info) {
-  if (b.count_empty() == 0)
+// Selects the specialized shallow search for a depth known only at runtime.
+// This is needed only where the deep search hands off to the shallow searches.
+template <int max_depth>
+int pvs_shallow_dispatch(Board &b, Eval* e, Color c, int depth, int alpha, int beta, bool passed_last, SearchInfo* search_info) {
+  if (depth == max_depth)
+    return pvs_shallow<max_depth>(b, e, c, alpha, beta, passed_last, search_info);
+  return pvs_shallow_dispatch<max_depth-1>(b, e, c, depth, alpha, beta, passed_last, search_info);
+}
+
+template <>
+int pvs_shallow_dispatch<0>(Board &b, Eval* e, Color c, int depth, int alpha, int beta, bool passed_last, SearchInfo* search_info) {
+  return pvs_shallow<0>(b, e, c, alpha, beta, passed_last, search_info);
+}
+
+// pvs(), with the number of empty squares passed down from the parent so
+// that it is not counted again at every node.
+int pvs_search(Board &b, Eval* e, Color c, int depth, int empties, int alpha, int beta, bool passed_last,
+  SearchInfo* search_info);
+
+int pvs_deep(Board &b, Eval* e, Color c, int depth, int empties, int alpha, int beta, bool passed_last,
+  SearchInfo* search_info) {
+  if (empties == 0)
     return score_game_end(b, c);
-  if (depth <= 2) {
-    return pvs_2(b, e, c, alpha, beta, passed_last, search_info);
+  if (depth <= PVS_SHALLOW_DEPTH) {
+    return pvs_shallow_dispatch<PVS_SHALLOW_DEPTH>(b, e, c, depth, alpha, beta, passed_last, search_info);
   }
 
   int score, bestScore = -INFTY;
@@ -139,41 +133,42 @@ int pvs_deep(Board &b, Eval* e, Color c, int depth, int alpha, int beta, bool pa
   // Probe transposition table for a score or move
   // Do this only at depth 4 and above for efficiency
   if (depth >= 4) {
-    HashEntry *entry = search_info->tt->get(b, c);
-    if (entry != nullptr) {
+    HashEntry entry;
+    if (search_info->tt->get(b, c, &entry)) {
       // For all-nodes, we only have an upper bound score
-      if (entry->nodeType == ALL_NODE) {
-        if (entry->depth >= depth && entry->selectivity >= search_info->selectivity && entry->score <= alpha)
-          return entry->score;
+      if (entry.nodeType == ALL_NODE) {
+        if (entry.depth >= depth && entry.selectivity >= search_info->selectivity && entry.score <= alpha)
+          return entry.score;
       }
       else {
-        if (entry->depth >= depth && entry->selectivity >= search_info->selectivity) {
+        if (entry.depth >= depth && entry.selectivity >= search_info->selectivity) {
           // For cut-nodes, we have a lower bound score
-          if (entry->nodeType == CUT_NODE && entry->score >= beta)
-            return entry->score;
+          if (entry.nodeType == CUT_NODE && entry.score >= beta)
+            return entry.score;
           // For PV-nodes, we have an exact score we can return
-          else if (entry->nodeType == PV_NODE && !isPVNode)
-            return entry->score;
+          else if (entry.nodeType == PV_NODE && !isPVNode)
+            return entry.score;
         }
-        // Try the hash move first
-        hashed = entry->move;
-        Board copy = b.copy();
-        Eval ec = *e;
-        uint64_t mask = copy.get_do_move(c, hashed);
-        ec.update(c, hashed, mask);
-        copy.do_move(c, hashed, mask);
-        search_info->nodes++;
-        score = -pvs_deep(copy, &ec, ~c, depth-1, -beta, -alpha, false, search_info);
-
-        // If we received a timeout signal, propagate it upwards
-        if (score == TIMEOUT)
-          return -TIMEOUT;
-        if (score >= beta)
-          return score;
-        if (score > bestScore) {
-          bestScore = score;
-          if (alpha < score)
-            alpha = score;
+        // Try the hash move first. Tables may be shared between threads, so a
+        // torn entry could hold a move from another position.
+        if (entry.move < 64 && (b.legal_moves(c) & SQ_TO_BIT[entry.move])) {
+          hashed = entry.move;
+          SearchFrame &child = search_info->play(b, e, c, hashed);
+          search_info->nodes++;
+          search_info->ply++;
+          score = -pvs_deep(child.board, &child.eval, ~c, depth-1, empties-1, -beta, -alpha, false, search_info);
+          search_info->ply--;
+
+          // If we received a timeout signal, propagate it upwards
+          if (score == TIMEOUT)
+            return -TIMEOUT;
+          if (score >= beta)
+            return score;
+          if (score > bestScore) {
+            bestScore = score;
+            if (alpha < score)
+              alpha = score;
+          }
         }
       }
     }
@@ -181,7 +176,7 @@ int pvs_deep(Board &b, Eval* e, Color c, int depth, int alpha, int beta, bool pa
 
   // Static eval pruning
   if (!isPVNode && search_info->selectivity < NO_SELECTIVITY) {
-    int static_eval = pvs_0(b, e, c, search_info);
+    int static_eval = heuristic(b, e, c);
     if (depth <= 3
      && static_eval >= beta + static_eval_margin(BETA_BOUND, depth, sel_factor)) {
       return beta;
@@ -199,26 +194,26 @@ int pvs_deep(Board &b, Eval* e, Color c, int depth, int alpha, int beta, bool pa
 
       // if (static_eval >= beta - static_error) {
       //   int mpc_beta = beta + mpc_error + abs(beta) / 16;
-      //   int mpc_score = pvs(b, e, c, mpc_depth, mpc_beta-1, mpc_beta, passed_last, search_info);
+      //   int mpc_score = pvs_search(b, e, c, mpc_depth, empties, mpc_beta-1, mpc_beta, passed_last, search_info);
       //   if (mpc_score >= mpc_beta)
       //     return beta;
       // }
 
       if (static_eval < alpha + static_error) {
         int mpc_alpha = alpha - mpc_error - abs(alpha) / 16;
-        int mpc_score = pvs(b, e, c, mpc_depth, mpc_alpha, mpc_alpha+1, passed_last, search_info);
+        int mpc_score = pvs_search(b, e, c, mpc_depth, empties, mpc_alpha, mpc_alpha+1, passed_last, search_info);
         if (mpc_score <= mpc_alpha)
           return alpha;
       }
     }
   }
 
-  ArrayList legalMoves = b.legal_movelist(c);
-  if (legalMoves.size() <= 0) {
+  uint64_t legal = b.legal_moves(c);
+  if (!legal) {
     if (passed_last)
       return score_game_end(b, c);
 
-    score = -pvs_deep(b, e, ~c, depth, -beta, -alpha, true, search_info);
+    score = -pvs_deep(b, e, ~c, depth, empties, -beta, -alpha, true, search_info);
 
     // If we received a timeout signal, propagate it upwards
     if (score == TIMEOUT)
@@ -227,63 +222,63 @@ int pvs_deep(Board &b, Eval* e, Color c, int depth, int alpha, int beta, bool pa
     return score;
   }
   // Remove the hash move since it has already been searched
-  if (hashed != MOVE_NULL) {
-    for (int i = 0; i < legalMoves.size(); i++) {
-      if (legalMoves.get(i) == hashed) {
-        legalMoves.remove(i);
-        break;
-      }
-    }
-  }
+  if (hashed != MOVE_NULL)
+    legal &= ~SQ_TO_BIT[hashed];
 
   // Move ordering
-  ArrayList scores;
+  MoveList &moves = search_info->stack[search_info->ply].moves;
+  moves = MoveList(legal);
+  #if MOVE_HISTORY
+  int killer = search_info->killers[search_info->ply];
+  #endif
   if (depth >= 4) {
     // PV nodes: sort search with higher depth
-    for (int i = 0; i < legalMoves.size(); i++) {
-      int m = legalMoves.get(i);
-      Board copy = b.copy();
-      Eval ec = *e;
-      uint64_t mask = copy.get_do_move(c, m);
-      ec.update(c, m, mask);
-      copy.do_move(c, m, mask);
+    for (int i = 0; i < moves.size(); i++) {
+      int m = moves.move(i);
+      SearchFrame &child = search_info->play(b, e, c, m);
       search_info->nodes++;
       int ss_depth = isPVNode ? std::max(0, (depth - 6) / 3)
                               : std::max(0, (depth - 7) / 4);
-      int p = -pvs(copy, &ec, ~c, ss_depth, -INFTY, INFTY, false, search_info);
+      search_info->ply++;
+      int p = -pvs_search(child.board, &child.eval, ~c, ss_depth, empties-1, -INFTY, INFTY, false, search_info);
+      search_info->ply--;
       if (!isPVNode) {
-        p -= 1500*copy.count_legal_moves(~c);
+        p -= 1500*child.board.count_legal_moves(~c);
+        #if MOVE_HISTORY
+        p += search_info->history[c][m] >> 2;
+        if (m == killer)
+          p += 5000;
+        #endif
       }
-      scores.add(p);
+      moves.set_score(i, p);
     }
   } else {
     // Low depths: piece square table and fastest first
     uint64_t empty = ~b.occupied();
-    for (int i = 0; i < legalMoves.size(); i++) {
-      int m = legalMoves.get(i);
+    for (int i = 0; i < moves.size(); i++) {
+      int m = moves.move(i);
       Board copy = b.copy();
       copy.do_move(c, m);
       int p = SQ_VAL[m] - 32*copy.count_legal_moves(~c);
       if (!(NEIGHBORS[m] & empty))
         p += 16;
-      scores.add(p);
+      #if MOVE_HISTORY
+      p += search_info->history[c][m] >> 4;
+      if (m == killer)
+        p += 100;
+      #endif
+      moves.set_score(i, p);
     }
   }
 
   int i = 0;
-  for (int m = next_move(legalMoves, scores, i); m != MOVE_NULL;
-           m = next_move(legalMoves, scores, ++i)) {
-    // Check for a timeout
-    if (search_info->time_limit != 0 && (search_info->nodes & 127) == 127) {
-      if (get_time_elapsed(search_info->search_start) > search_info->time_limit)
-        return -TIMEOUT;
-    }
+  for (int m = moves.next(i); m != MOVE_NULL; m = moves.next(++i)) {
+    // Check for a timeout, a stop from another thread, or the node limit
+    if ((search_info->control != nullptr && search_info->control->stopped())
+     || search_info->nodes >= search_info->node_limit)
+      return -TIMEOUT;
 
-    Board copy = b.copy();
-    Eval ec = *e;
-    uint64_t mask = copy.get_do_move(c, m);
-    ec.update(c, m, mask);
-    copy.do_move(c, m, mask);
+    SearchFrame &child = search_info->play(b, e, c, m);
     search_info->nodes++;
 
     int reduction = 0;
@@ -294,15 +289,17 @@ int pvs_deep(Board &b, Eval* e, Color c, int depth, int alpha, int beta, bool pa
       reduction *= 2;
     }
 
+    search_info->ply++;
     if (i > 0 || hashed != MOVE_NULL) {
-      score = -pvs(copy, &ec, ~c, depth-1-reduction, -alpha-1, -alpha, false, search_info);
+      score = -pvs_search(child.board, &child.eval, ~c, depth-1-reduction, empties-1, -alpha-1, -alpha, false, search_info);
       if (reduction > 0 && score > alpha)
-        score = -pvs_deep(copy, &ec, ~c, depth-1, -alpha-1, -alpha, false, search_info);
+        score = -pvs_deep(child.board, &child.eval, ~c, depth-1, empties-1, -alpha-1, -alpha, false, search_info);
       if (alpha < score && score < beta)
-        score = -pvs_deep(copy, &ec, ~c, depth-1, -beta, -alpha, false, search_info);
+        score = -pvs_deep(child.board, &child.eval, ~c, depth-1, empties-1, -beta, -alpha, false, search_info);
     }
     else
-      score = -pvs_deep(copy, &ec, ~c, depth-1, -beta, -alpha, false, search_info);
+      score = -pvs_deep(child.board, &child.eval, ~c, depth-1, empties-1, -beta, -alpha, false, search_info);
+    search_info->ply--;
 
     // If we received a timeout signal, propagate it upwards
     if (score == TIMEOUT)
@@ -310,6 +307,9 @@ int pvs_deep(Board &b, Eval* e, Color c, int depth, int alpha, int beta, bool pa
     if (score >= beta) {
       if (depth >= 4)
         search_info->tt->add(b, c, score, search_info->selectivity, m, search_info->root_age, depth, CUT_NODE);
+      #if MOVE_HISTORY
+      search_info->add_cutoff(c, m, depth);
+      #endif
       return score;
     }
     if (score > bestScore) {
@@ -329,24 +329,50 @@ int pvs_deep(Board &b, Eval* e, Color c, int depth, int alpha, int beta, bool pa
   return bestScore;
 }
 
+SearchFrame *thread_stack() {
+  static thread_local std::vector<SearchFrame> stack(MAX_PLY + 1);
+  return stack.data();
+}
+
 int pvs(Board &b, Eval* e, Color c, int depth, int alpha, int beta, bool passed_last, SearchInfo* search_info) {
-  switch (depth) {
-    case 0:
-      return pvs_0(b, e, c, search_info);
-    case 1:
-      return pvs_1(b, e, c, alpha, beta, passed_last, search_info);
-    case 2:
-      return pvs_2(b, e, c, alpha, beta, passed_last, search_info);
-    default:
-      return pvs_deep(b, e, c, depth, alpha, beta, passed_last, search_info);
+  return pvs_search(b, e, c, depth, b.count_empty(), alpha, beta, passed_last, search_info);
+}
+
+int pvs_search(Board &b, Eval* e, Color c, int depth, int empties, int alpha, int beta, bool passed_last,
+  SearchInfo* search_info) {
+  // Depth 0 searches are sort searches, whose children are evaluated again by
+  // the sort searches of later iterations and re-searches. The leaves of the
+  // shallow searches are mostly new, so they are not worth caching.
+  if (depth == 0 && search_info->eval_cache != nullptr) {
+    search_info->eval_probes++;
+    int score;
+    if (search_info->eval_cache->get(b, c, &score)) {
+      search_info->eval_hits++;
+      return score;
+    }
+    score = heuristic(b, e, c);
+    search_info->eval_cache->add(b, c, score);
+    return score;
   }
+  if (depth <= PVS_SHALLOW_DEPTH)
+    return pvs_shallow_dispatch<PVS_SHALLOW_DEPTH>(b, e, c, depth, alpha, beta, passed_last, search_info);
+  return pvs_deep(b, e, c, depth, empties, alpha, beta, passed_last, search_info);
 }
 
 int pvs_best_move(Board &b, Eval* e, Color c, ArrayList &moves, int* best_score, int depth, SearchInfo* search_info) {
+  return pvs_root(b, e, c, moves, best_score, depth, -INFTY, INFTY, search_info, nullptr);
+}
+
+int pvs_root(Board &b, Eval* e, Color c, ArrayList &moves, int* best_score, int depth, int alpha, int beta,
+  SearchInfo* search_info, std::vector<uint64_t> *move_nodes) {
   int score;
-  int best_move = MOVE_BROKEN;
-  int alpha = -INFTY;
-  int beta = INFTY;
+  int best_move = 0;
+  *best_score = -INFTY;
+  if (move_nodes != nullptr)
+    move_nodes->assign(moves.size(), 0);
+  #if MOVE_HISTORY
+  search_info->age_history();
+  #endif
 
   for (int i = 0; i < moves.size(); i++) {
     int m = moves.get(i);
@@ -355,6 +381,7 @@ int pvs_best_move(Board &b, Eval* e, Color c, ArrayList &moves, int* best_score,
     uint64_t mask = copy.get_do_move(c, m);
     ec.update(c, m, mask);
     copy.do_move(c, m, mask);
+    uint64_t start_nodes = search_info->nodes;
     search_info->nodes++;
     if (i != 0) {
       score = -pvs(copy, &ec, ~c, depth-1, -alpha-1, -alpha, false, search_info);
@@ -366,13 +393,101 @@ int pvs_best_move(Board &b, Eval* e, Color c, ArrayList &moves, int* best_score,
     // Handle timeouts
     if (score == TIMEOUT)
       return MOVE_BROKEN;
+    if (move_nodes != nullptr)
+      (*move_nodes)[i] = search_info->nodes - start_nodes;
 
-    if (score > alpha) {
-      alpha = score;
+    if (score > *best_score) {
       *best_score = score;
       best_move = i;
+      if (score >= beta)
+        break;
+      if (score > alpha)
+        alpha = score;
     }
   }
 
   return best_move;
 }
+
+int pvs_multi_pv(Board &b, Eval* e, Color c, ArrayList &moves, int k, int depth, SearchInfo* search_info,
+  std::vector<PVLine> &lines) {
+  // The first top moves are the best lines so far, sorted by score
+  ArrayList scores;
+  int top = 0;
+  #if MOVE_HISTORY
+  search_info->age_history();
+  #endif
+
+  for (int i = 0; i < moves.size(); i++) {
+    int m = moves.get(i);
+    Board copy = b.copy();
+    Eval ec = *e;
+    uint64_t mask = copy.get_do_move(c, m);
+    ec.update(c, m, mask);
+    copy.do_move(c, m, mask);
+    search_info->nodes++;
+    int score;
+    if (top < k)
+      score = -pvs(copy, &ec, ~c, depth-1, -INFTY, INFTY, false, search_info);
+    else {
+      // Only an exact score better than the k-th best line is needed
+      int alpha = scores.get(k-1);
+      score = -pvs(copy, &ec, ~c, depth-1, -alpha-1, -alpha, false, search_info);
+      if (alpha < score && score != TIMEOUT)
+        score = -pvs(copy, &ec, ~c, depth-1, -INFTY, -alpha, false, search_info);
+    }
+    // Handle timeouts
+    if (score == TIMEOUT)
+      return MOVE_BROKEN;
+    scores.add(score);
+
+    if (top == k && score <= scores.get(k-1))
+      continue;
+    // Insert into the best lines, pushing the rest back by one
+    int j = i;
+    while (j > 0 && (j > top || scores.get(j-1) < score)) {
+      moves.swap(j, j-1);
+      scores.swap(j, j-1);
+      j--;
+    }
+    top = std::min(top + 1, k);
+  }
+
+  lines.clear();
+  for (int i = 0; i < top; i++)
+    lines.push_back(PVLine{scores.get(i), hash_pv(b, c, moves.get(i), depth, search_info->tt)});
+  return top;
+}
+
+std::vector<int> hash_pv(Board &b, Color c, int move, int depth, Hash *tt) {
+  std::vector<int> pv;
+  pv.push_back(move);
+  Board pos = b.copy();
+  pos.do_move(c, move);
+  c = ~c;
+
+  int ply = 1;
+  while (ply < depth) {
+    uint64_t legal = pos.legal_moves(c);
+    if (!legal) {
+      if (!pos.legal_moves(~c))
+        break;
+      // Passes do not use up depth
+      pv.push_back(MOVE_NULL);
+      c = ~c;
+      continue;
+    }
+    // Tables may be shared between threads, so check the move is legal
+    HashEntry entry;
+    if (!tt->get(pos, c, &entry) || entry.move >= 64 || !(legal & SQ_TO_BIT[entry.move]))
+      break;
+    pv.push_back(entry.move);
+    pos.do_move(c, entry.move);
+    c = ~c;
+    ply++;
+  }
+
+  if (pv.back() == MOVE_NULL)
+    pv.pop_back();
+  return pv;
+}
@@ -0,0 +1,96 @@
+#include "searchcontrol.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Deadline {
+  TimePoint time;
+  const SearchControl *control;
+  std::atomic<bool> *stopFlag;
+};
+
+// The deadlines of all timed controls, and the thread that sets their stop
+// flags as they pass. The thread is started on the first time limit and runs
+// until exit, so it and its state are never destroyed.
+struct Timer {
+  std::mutex lock;
+  std::condition_variable wake;
+  std::vector<Deadline> deadlines;
+
+  Timer() {
+    std::thread(&Timer::run, this).detach();
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+      if (deadlines.empty()) {
+        wake.wait(guard);
+        continue;
+      }
+      auto first = std::min_element(deadlines.begin(), deadlines.end(),
+        [](const Deadline &a, const Deadline &b) { return a.time < b.time; });
+      if (Clock::now() >= first->time) {
+        *first->stopFlag = true;
+        deadlines.erase(first);
+      } else {
+        wake.wait_until(guard, first->time);
+      }
+    }
+  }
+
+  // Removes the deadline of control, if any. Must hold lock.
+  void cancel(const SearchControl *control) {
+    deadlines.erase(std::remove_if(deadlines.begin(), deadlines.end(),
+      [control](const Deadline &d) { return d.control == control; }), deadlines.end());
+  }
+};
+
+Timer &timer() {
+  static Timer *t = new Timer();
+  return *t;
+}
+
+}  // namespace
+
+SearchControl::SearchControl(const SearchControl *p)
+  : parent(p), stopFlag(false), startTime(Clock::now()) {}
+
+SearchControl::~SearchControl() {
+  finish();
+}
+
+void SearchControl::start(uint64_t time_limit) {
+  finish();
+  stopFlag = false;
+  startTime = Clock::now();
+  if (time_limit != 0)
+    set_limit(time_limit);
+}
+
+void SearchControl::set_limit(uint64_t time_limit) {
+  Timer &t = timer();
+  {
+    std::lock_guard<std::mutex> guard(t.lock);
+    t.cancel(this);
+    t.deadlines.push_back(Deadline{Clock::now() + std::chrono::milliseconds(time_limit),
+      this, &stopFlag});
+  }
+  t.wake.notify_one();
+}
+
+void SearchControl::stop() {
+  stopFlag = true;
+}
+
+void SearchControl::finish() {
+  Timer &t = timer();
+  std::lock_guard<std::mutex> guard(t.lock);
+  t.cancel(this);
+}
@@ -0,0 +1,48 @@
+#ifndef __SEARCHCONTROL_H__
+#define __SEARCHCONTROL_H__
+
+#include <atomic>
+#include "common.h"
+
+// Decides when a search must stop. The stop flag can be set from any thread,
+// such as a protocol thread handling a stop command, and a timer thread sets
+// it when the time limit passes. One long-lived timer thread serves the time
+// limits of all controls, so timed searches do not start threads. Searches poll stopped() at every interior
+// node, which is one relaxed atomic load, so stop latency is bounded by the
+// time to search a leaf subtree.
+//
+// A control can have a parent, and is then also stopped when its parent is.
+// This lets a search with its own time limit or cutoff be stopped from above.
+class SearchControl {
+ public:
+  SearchControl(const SearchControl *parent = nullptr);
+  ~SearchControl();
+  SearchControl(const SearchControl &other) = delete;
+  SearchControl& operator=(const SearchControl &other) = delete;
+
+  // Clears the stop flag and starts the clock. If time_limit is not 0, the
+  // search is stopped after time_limit ms.
+  void start(uint64_t time_limit);
+  // Stops the search time_limit ms from now, replacing any earlier limit,
+  // without clearing the stop flag. For a search already running, such as a
+  // ponder search on a ponder hit.
+  void set_limit(uint64_t time_limit);
+  // Stops the search. Safe to call from any thread.
+  void stop();
+  // Cancels the time limit, if any, without stopping the search.
+  void finish();
+
+  bool stopped() const {
+    return stopFlag.load(std::memory_order_relaxed)
+        || (parent != nullptr && parent->stopped());
+  }
+  // Time in ms since start().
+  uint64_t elapsed() const { return get_time_elapsed(startTime); }
+
+ private:
+  const SearchControl *parent;
+  std::atomic<bool> stopFlag;
+  TimePoint startTime;
+};
+
+#endif
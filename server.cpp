@@ -0,0 +1,229 @@
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "eval.h"
+#include "player.h"
+using namespace std;
+
+// Analysis server. Reads one command per line from stdin, and answers each
+// position query with one JSON object per line on stdout:
+//   position [taken] [black] [side]  hex bitboards, as for FlippyT
+//   position [board] [side]          64 characters of X, O, and -
+//   go [depth n] [time ms] [nodes n] [multipv k]
+//   go solve|wld [time ms] [multipv k]
+//   stop                             ends the running go early
+//   eval                             static evaluation of the position
+//   isready
+//   quit
+// The hash tables are kept between queries. A go runs on its own thread, so
+// that stop can be read while it searches. Any other command waits for it.
+
+namespace {
+
+mutex outputLock;
+
+void send(const string &line) {
+  lock_guard<mutex> lock(outputLock);
+  cout << line << endl;
+}
+
+void send_error(const string &message) {
+  send("{\"error\":\"" + message + "\"}");
+}
+
+string json_move(int m) {
+  if (m == MOVE_BROKEN)
+    return "null";
+  if (m == MOVE_NULL)
+    return "\"pass\"";
+  return "\"" + print_move(m) + "\"";
+}
+
+string json_pv(const vector<int> &pv) {
+  string result = "[";
+  for (unsigned int i = 0; i < pv.size(); i++) {
+    if (i != 0)
+      result += ",";
+    result += (pv[i] == MOVE_NULL) ? "\"ps\"" : json_move(pv[i]);
+  }
+  return result + "]";
+}
+
+// Midgame scores in discs with two decimals, and solve scores as integers
+string json_score(int score, bool solved) {
+  if (solved)
+    return to_string(score);
+  stringstream ss;
+  ss << fixed << setprecision(2) << (double) score / EVAL_SCALE_FACTOR;
+  return ss.str();
+}
+
+string json_result(const AnalysisResult &r, const string &type) {
+  bool solved = (type != "search");
+  stringstream ss;
+  ss << "{\"type\":\"" << type << "\",\"bestmove\":" << json_move(r.best_move)
+     << ",\"depth\":" << r.depth;
+  if (!r.lines.empty()) {
+    int score = r.lines[0].score;
+    ss << ",\"score\":" << json_score(score, solved);
+    if (type == "wld")
+      ss << ",\"result\":\"" << (score > 0 ? "win" : (score < 0 ? "loss" : "draw")) << "\"";
+    ss << ",\"pv\":" << json_pv(r.lines[0].pv);
+  }
+  ss << ",\"nodes\":" << r.nodes << ",\"time\":" << r.ms
+     << ",\"nps\":" << 1000 * r.nodes / r.ms;
+  if (r.lines.size() > 1) {
+    ss << ",\"lines\":[";
+    for (unsigned int i = 0; i < r.lines.size(); i++) {
+      if (i != 0)
+        ss << ",";
+      ss << "{\"score\":" << json_score(r.lines[i].score, solved)
+         << ",\"pv\":" << json_pv(r.lines[i].pv) << "}";
+    }
+    ss << "]";
+  }
+  ss << "}";
+  return ss.str();
+}
+
+bool parse_side(const string &s, Color *side) {
+  if (s == "black" || s == "b" || s == "X") {
+    *side = BLACK;
+    return true;
+  }
+  if (s == "white" || s == "w" || s == "O") {
+    *side = WHITE;
+    return true;
+  }
+  return false;
+}
+
+bool parse_position(stringstream &ss, Player *player) {
+  vector<string> args;
+  string arg;
+  while (ss >> arg)
+    args.push_back(arg);
+
+  Color side;
+  if (args.size() == 2 && args[0].size() == 64 && parse_side(args[1], &side)) {
+    player->game = Board(args[0]);
+  } else if (args.size() == 3 && parse_side(args[2], &side)) {
+    uint64_t taken_bits, black_bits;
+    stringstream hex_ss;
+    hex_ss << std::hex << args[0] << " " << args[1];
+    if (!(hex_ss >> taken_bits >> black_bits))
+      return false;
+    player->set_position(taken_bits, black_bits);
+  } else {
+    return false;
+  }
+  player->mySide = side;
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  int threads = 1;
+  uint64_t hash_mb = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--hash-mb") && i + 1 < argc) {
+      hash_mb = strtoull(argv[++i], nullptr, 10);
+    } else {
+      cerr << "usage: " << argv[0] << " [-t threads] [--hash-mb mb]" << endl;
+      exit(-1);
+    }
+  }
+
+  init_eval();
+  Player player(BLACK, false, /*tt_bits=*/20);
+  player.set_threads(threads);
+  // Queries often repeat positions in other orientations
+  player.transpositionTable->set_symmetric(SYMMETRIC_EMPTIES);
+  if (hash_mb > 0)
+    player.set_hash_mb(hash_mb);
+  else
+    resize_endhash(12);
+  player.print_hash_memory(cerr);
+
+  thread search;
+  string line;
+  while (getline(cin, line)) {
+    stringstream ss(line);
+    string command;
+    if (!(ss >> command))
+      continue;
+
+    if (command == "stop") {
+      player.stop();
+      continue;
+    }
+    if (command == "isready") {
+      send("{\"ready\":true}");
+      continue;
+    }
+    if (command == "quit")
+      player.stop();
+    // Everything else waits for the running search, if any
+    if (search.joinable())
+      search.join();
+
+    if (command == "quit") {
+      break;
+    } else if (command == "position") {
+      if (!parse_position(ss, &player))
+        send_error("bad position");
+    } else if (command == "go") {
+      string type = "search";
+      int depth = 0, multi_pv = 1;
+      uint64_t ms = 0, max_nodes = 0;
+      string arg;
+      bool ok = true;
+      while (ok && ss >> arg) {
+        if (arg == "solve" || arg == "wld")
+          type = arg;
+        else if (arg == "depth")
+          ok = static_cast<bool>(ss >> depth);
+        else if (arg == "time")
+          ok = static_cast<bool>(ss >> ms);
+        else if (arg == "nodes")
+          ok = static_cast<bool>(ss >> max_nodes);
+        else if (arg == "multipv")
+          ok = static_cast<bool>(ss >> multi_pv);
+        else
+          ok = false;
+      }
+      if (!ok) {
+        send_error("bad go: " + line);
+        continue;
+      }
+
+      player.multiPv = max(1, multi_pv);
+      player.clear_stop();
+      search = thread([&player, type, depth, ms, max_nodes]() {
+        AnalysisResult result = (type == "search")
+          ? player.analyze(depth, ms, max_nodes)
+          : player.solve(type == "wld", ms);
+        send(json_result(result, type));
+      });
+    } else if (command == "eval") {
+      Eval e;
+      init_evaluator(player.game, &e);
+      send("{\"eval\":" + json_score(heuristic(player.game, &e, player.mySide), false) + "}");
+    } else {
+      send_error("unknown command: " + command);
+    }
+  }
+
+  if (search.joinable())
+    search.join();
+  return 0;
+}
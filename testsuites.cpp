@@ -1,34 +1,141 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 #include "common.h"
 #include "board.h"
 #include "endgame.h"
 #include "player.h"
 
+std::vector<std::string> split(const std::string &s, char d);
+uint64_t perft(Board &b, Color c, int depth, bool passed);
+uint64_t parallel_perft(int depth, int threads, int hash_bits);
+extern const uint64_t PERFT_COUNTS[15];
+
 namespace {
 
 // Prints a usage statement.
 void usage() {
   std::cerr << "Usage: testsuites    [test type] [option]" << std::endl;
-  std::cerr << "Test types: perft    [depth]" << std::endl;
+  std::cerr << "Test types: perft    [depth] [threads] [hash bits] hash bits 0 turns off the cache" << std::endl;
   std::cerr << "            bench    [depth] [sel]" << std::endl;
-  std::cerr << "            ffo      [n] tests the first n positions" << std::endl;
-  std::cerr << "            eg       [14|16|18|20|22] test 500 positions to given depth" << std::endl;
+  std::cerr << "            ffo      [n] [threads] [csv|json] tests the first n positions" << std::endl;
+  std::cerr << "            eg       [14|16|18|20|22] [threads] [csv|json] test 500 positions to given depth" << std::endl;
   std::cerr << "            eval_acc [depth] test eg eval accuracy @ depth" << std::endl;
+  std::cerr << "            multipv  [depth] [k] prints the k best lines of the bench positions" << std::endl;
+  std::cerr << "            tune     [14|16|18|20|22] [threads] [file] tunes the endgame solver depths" << std::endl;
+  std::cerr << "            report   [perft|bench|ffo|eg|eval_acc] [depth or n] [-r reps] [-t threads]" << std::endl;
+  std::cerr << "                     [-o file] [-b baseline] [-x percent] writes a JSON report" << std::endl;
+  std::cerr << "ffo and eg print per-depth solver statistics to stdout as csv or json," << std::endl;
+  std::cerr << "if compiled with ENDGAME_STATS in endgame.h" << std::endl;
 }
 
-}  // namespace
+void print_stats(EndgameStatistics &stats, const std::string &format) {
+  if (!ENDGAME_STATS) {
+    std::cerr << "Statistics are not counted: set ENDGAME_STATS in endgame.h" << std::endl;
+    return;
+  }
+  if (format == "json")
+    stats.print_json(std::cout);
+  else
+    stats.print_csv(std::cout);
+}
 
-std::vector<std::string> split(const std::string &s, char d);
+const char ENDGAME_CONFIG_FILE[] = "Flippy_Resources/endgame_config.txt";
+
+// The solver depths used by ffo and eg, and the starting point for tune
+EndgameConfig endgameConfig;
+
+// Gets the eg suite file for a maximum depth, and sizes the hash tables for
+// it. Returns an empty string for an unknown depth.
+std::string eg_suite(int max_depth) {
+  switch (max_depth) {
+    case 14:
+      resize_endhash(6);
+      return "ffotest/eg_13_14.txt";
+    case 16:
+      resize_endhash(7);
+      return "ffotest/eg_15_16.txt";
+    case 18:
+      resize_endhash(8);
+      return "ffotest/eg_17_18.txt";
+    case 20:
+      resize_endhash(10);
+      return "ffotest/eg_19_20.txt";
+    case 22:
+      resize_endhash(12);
+      return "ffotest/eg_21_22.txt";
+  }
+  return "";
+}
+
+struct EgPosition {
+  Board b;
+  Color side;
+  // Exact score for the side to move
+  int score;
+};
+
+// Reads the positions of eg suite files, which have lines of a board, the
+// side to move, the best move, and the score for black.
+std::vector<EgPosition> read_eg_positions(const std::string &file) {
+  std::vector<EgPosition> positions;
+  std::ifstream cfile(file);
+  std::string line;
+  while (getline(cfile, line)) {
+    std::vector<std::string> parts = split(line, ' ');
+    if (parts.size() < 4)
+      continue;
+    Color side = (parts[1] == "Black") ? BLACK : WHITE;
+    int score = std::stoi(parts[3]);
+    positions.push_back(EgPosition{Board(line.substr(0, 64)), side,
+      (side == WHITE) ? -score : score});
+  }
+  return positions;
+}
+
+// Reads an ffo position file: a board, the side to move, and a comment with
+// the solution.
+bool read_ffo_position(const std::string &file, Board *b, Color *side, std::string *comment) {
+  std::ifstream cfile(file);
+  std::string board, color;
+  if (!getline(cfile, board) || !getline(cfile, color))
+    return false;
+  getline(cfile, *comment);
+  *b = Board(board.substr(0, 64));
+  *side = (color[0] == 'B') ? BLACK : WHITE;
+  return true;
+}
+
+// Reads the known score for the side to move from an ffo comment: its first
+// signed number, such as +38 in "A2:+38". Returns false if there is none.
+bool ffo_solution(const std::string &comment, int *score) {
+  for (unsigned int i = 0; i + 1 < comment.size(); i++) {
+    if ((comment[i] == '+' || comment[i] == '-') && isdigit(comment[i+1])) {
+      *score = std::stoi(comment.substr(i));
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
 
-uint64_t perft(Board &b, Color c, int depth, bool passed);
 void bench(std::string file, int depth, int sel);
-uint64_t ffo(std::string file);
-void egtest(std::string file);
+uint64_t ffo(std::string file, int threads, EndgameStatistics &stats);
+void egtest(std::string file, int threads, EndgameStatistics &stats);
 void eval_acc(int depth);
+void multipv(std::string file, int depth, int k);
+bool tune(std::string file, int threads, std::string out_file);
+int report(int argc, char **argv);
 
 int main(int argc, char **argv) {
   // if (argc != 3) {
@@ -37,15 +144,22 @@ int main(int argc, char **argv) {
   // }
 
   init_eval();
+  if (endgameConfig.read_file(ENDGAME_CONFIG_FILE))
+    std::cerr << "Using endgame config " << ENDGAME_CONFIG_FILE << std::endl;
 
   if (std::string(argv[1]) == "perft") {
-    auto start_time = Clock::now();
-    Board b;
     int plies = std::stoi(argv[2]);
-    uint64_t nodes = perft(b, BLACK, plies, false);
+    int threads = (argc >= 4) ? std::stoi(argv[3]) : std::max(1U, std::thread::hardware_concurrency());
+    int hash_bits = (argc >= 5) ? std::stoi(argv[4]) : 20;
+    auto start_time = Clock::now();
+    uint64_t nodes = parallel_perft(plies, threads, hash_bits);
     uint64_t time_ms = get_time_elapsed(start_time);
     std::cerr << "Nodes: " << nodes << " | NPS: " << 1000 * nodes / time_ms << std::endl;
-    std::cerr << "Time: " << time_ms << " ms" << std::endl;
+    std::cerr << "Time: " << time_ms << " ms | threads: " << threads << std::endl;
+    if (plies < 15 && nodes != PERFT_COUNTS[plies]) {
+      std::cerr << "Error: expected " << PERFT_COUNTS[plies] << std::endl;
+      return 1;
+    }
   } else if (std::string(argv[1]) == "bench") {
     int depth = std::stoi(argv[2]);
     int sel = 1;
@@ -54,41 +168,48 @@ int main(int argc, char **argv) {
   } else if (std::string(argv[1]) == "ffo") {
     uint64_t ms = 0;
     int positions = std::stoi(argv[2]);
+    int threads = 1;
+    if (argc >= 4) threads = std::stoi(argv[3]);
+    EndgameStatistics stats;
     resize_endhash(14);
     for (int i = 0; i < positions; i++) {
       std::string file_name = "ffotest/end";
       file_name += std::to_string(40 + i);
       file_name += ".pos";
-      ms += ffo(file_name);
+      ms += ffo(file_name, threads, stats);
     }
     std::cerr << "Time: " << ms / 1000.0 << " s" << std::endl;
+    if (argc >= 5) print_stats(stats, argv[4]);
   } else if (std::string(argv[1]) == "eg") {
     int max_depth = std::stoi(argv[2]);
-    switch (max_depth) {
-      case 14:
-        resize_endhash(6);
-        egtest("ffotest/eg_13_14.txt");
-        break;
-      case 16:
-        resize_endhash(7);
-        egtest("ffotest/eg_15_16.txt");
-        break;
-      case 18:
-        resize_endhash(8);
-        egtest("ffotest/eg_17_18.txt");
-        break;
-      case 20:
-        resize_endhash(10);
-        egtest("ffotest/eg_19_20.txt");
-        break;
-      case 22:
-        resize_endhash(12);
-        egtest("ffotest/eg_21_22.txt");
-        break;
+    int threads = 1;
+    if (argc >= 4) threads = std::stoi(argv[3]);
+    std::string file = eg_suite(max_depth);
+    if (file.empty()) {
+      usage();
+      return 1;
     }
+    EndgameStatistics stats;
+    egtest(file, threads, stats);
+    if (argc >= 5) print_stats(stats, argv[4]);
   } else if (std::string(argv[1]) == "eval_acc") {
     int depth = std::stoi(argv[2]);
     eval_acc(depth);
+  } else if (std::string(argv[1]) == "multipv") {
+    int depth = std::stoi(argv[2]);
+    int k = (argc == 4) ? std::stoi(argv[3]) : 3;
+    multipv("Flippy_Resources/bench.txt", depth, k);
+  } else if (std::string(argv[1]) == "tune") {
+    std::string file = eg_suite(std::stoi(argv[2]));
+    if (file.empty()) {
+      usage();
+      return 1;
+    }
+    int threads = (argc >= 4) ? std::stoi(argv[3]) : 1;
+    if (!tune(file, threads, (argc >= 5) ? argv[4] : ENDGAME_CONFIG_FILE))
+      return 1;
+  } else if (std::string(argv[1]) == "report" && argc >= 4) {
+    return report(argc, argv);
   } else {
     usage();
     return 1;
@@ -102,6 +223,8 @@ void bench(std::string file, int depth, int sel) {
   std::ifstream cfile(file);
   uint64_t total_time = 0;
   uint64_t total_nodes = 0;
+  uint64_t eval_probes = 0;
+  uint64_t eval_hits = 0;
 
   if (cfile.is_open()) {
     std::string line;
@@ -138,45 +261,31 @@ void bench(std::string file, int depth, int sel) {
     uint64_t ms = get_time_elapsed(start_time);
     total_time += ms;
     total_nodes += p.get_nodes();
+    eval_probes += p.get_eval_probes();
+    eval_hits += p.get_eval_hits();
   }
 
   std::cerr << "Nodes: " << total_nodes << std::endl;
   std::cerr << "Total time: " << total_time << std::endl;
   std::cerr << "NPS: " << 1000 * total_nodes / total_time << std::endl;
+  if (eval_probes > 0)
+    std::cerr << "Eval cache hits: " << 100.0 * eval_hits / eval_probes << "%" << std::endl;
   std::cerr << "Time with overhead: " << get_time_elapsed(overhead) << std::endl;
 }
 
 // Sets up a solve of one position of the FFO suite, given a string with
 // the location of the FFO test position file.
-uint64_t ffo(std::string file) {
-  std::string line;
+uint64_t ffo(std::string file, int threads, EndgameStatistics &stats) {
+  Board b;
+  Color side;
   std::string ffostring;
-  std::ifstream cfile(file);
-  char board[64];
-
-  if (cfile.is_open()) {
-    getline(cfile, line);
-    const char *read = line.c_str();
-    for (int i = 0; i < 64; i++)
-      board[i] = read[i];
-
-    getline(cfile, line);
-    getline(cfile, ffostring);
-    std::cerr << ffostring << std::endl;
-  }
-
-  const char *read_color = line.c_str();
-  Color side = BLACK;
-  if (read_color[0] == 'B') {
-    std::cerr << "Solving for black: ";
-    side = BLACK;
-  }
-  else {
-    std::cerr << "Solving for white: ";
-    side = WHITE;
+  if (!read_ffo_position(file, &b, &side, &ffostring)) {
+    std::cerr << "Error: could not read " << file << std::endl;
+    return 0;
   }
+  std::cerr << ffostring << std::endl;
+  std::cerr << ((side == BLACK) ? "Solving for black: " : "Solving for white: ");
 
-  Board b(board);
   Eval e;
   init_evaluator(b, &e);
 
@@ -184,23 +293,29 @@ uint64_t ffo(std::string file) {
   int empties = b.count_empty();
   std::cerr << empties << " empty" << std::endl;
 
+  clear_endhash();
   Endgame eg;
+  eg.threads = threads;
+  eg.config = endgameConfig;
   int score;
   auto start_time = Clock::now();
   int m = eg.solve_endgame(b, &e, side, lm, false, empties, 100000000, &score);
   uint64_t ms = get_time_elapsed(start_time);
   std::cerr << "Solution: " << print_move(m) << " Score: " << score << " Time: " << ms << " ms" << std::endl;
+  std::cerr << "PV: " << print_pv(eg.pv) << std::endl;
   std::cerr << std::endl;
+  stats.add(eg.stats);
   return ms;
 }
 
-void egtest(std::string file) {
+void egtest(std::string file, int threads, EndgameStatistics &stats) {
   std::vector<std::string> positions;
   std::ifstream cfile(file);
   uint64_t total_time = 0;
   uint64_t total_nodes = 0;
   uint64_t min_time = 1 << 30;
   uint64_t max_time = 0;
+  int incorrect = 0;
 
   if (cfile.is_open()) {
     std::string line;
@@ -234,18 +349,23 @@ void egtest(std::string file) {
     ArrayList lm = b.legal_movelist(side);
     int empties = b.count_empty();
 
+    clear_endhash();
     Endgame eg;
+    eg.threads = threads;
+    eg.config = endgameConfig;
     int score;
     auto start_time = Clock::now();
     int m = eg.solve_endgame(b, &e, side, lm, false, empties, 100000000, &score);
     uint64_t ms = get_time_elapsed(start_time);
     total_time += ms;
     total_nodes += eg.nodes;
+    stats.add(eg.stats);
     if (ms < min_time) min_time = ms;
     if (ms > max_time) max_time = ms;
     if (/*m != move_sol || */score != score_sol) {
-      std::cerr << "Error: incorrect solution " << move_sol << " " << m << " " << score_sol << " " << score << std::endl;
-      return;
+      std::cerr << "Error: incorrect solution " << i+1 << ": " << move_sol << " " << m << " "
+                << score_sol << " " << score << std::endl;
+      incorrect++;
     }
   }
 
@@ -254,6 +374,8 @@ void egtest(std::string file) {
   std::cerr << "Min time: " << min_time << " max time: " << max_time << " avg time: " << total_time / 500 << std::endl;
   std::cerr << "NPS: " << 1000 * total_nodes / total_time << std::endl;
   std::cerr << "Time with overhead: " << get_time_elapsed(overhead) << std::endl;
+  if (incorrect > 0)
+    std::cerr << "Incorrect: " << incorrect << " of " << positions.size() << std::endl;
 }
 
 void eval_acc(int depth) {
@@ -300,7 +422,6 @@ void eval_acc(int depth) {
 
     Hash transpositionTable(12);
     SearchInfo search_info;
-    search_info.time_limit = 0;
     search_info.tt = &transpositionTable;
     search_info.other_heuristic = true;
     Eval e;
@@ -323,50 +444,162 @@ void eval_acc(int depth) {
   std::cerr << "Time with overhead: " << get_time_elapsed(overhead) << std::endl;
 }
 
-/*
- * Array of PERFT results from http://www.aartbik.com/MISC/reversi.html
- *
- DEPTH  #LEAF NODES   #FULL-DEPTH  #HIGHER
-==========================================
-   1            4
-   2           12
-   3           56
-   4          244
-   5         1396
-   6         8200
-   7        55092
-   8       390216
-   9      3005288
-  10     24571284
-  11    212258800  =    212258572  +    228
-  12   1939886636  =   1939886052  +    584
-  13  18429641748  =  18429634780  +   6968 
-  14 184042084512  = 184042061172  +  23340
-*/
+// PERFT leaf counts from the starting position, by depth, from
+// http://www.aartbik.com/MISC/reversi.html. From depth 11, they include games
+// that end before the full depth, which count as one leaf:
+//   11    212258800 =    212258572 +   228
+//   12   1939886636 =   1939886052 +   584
+//   13  18429641748 =  18429634780 +  6968
+//   14 184042084512 = 184042061172 + 23340
+const uint64_t PERFT_COUNTS[15] = { 1,
+  4, 12, 56, 244, 1396, 8200, 55092, 390216, 3005288, 24571284,
+  212258800ULL, 1939886636ULL, 18429641748ULL, 184042084512ULL
+};
+
+namespace {
+
+// Subtree counts of perft, keyed by position, side to move, and depth. The
+// table is shared by all threads without locks: as in EndHash, a check word
+// makes entries torn by concurrent writes fail to match.
+class PerftHash {
+ public:
+  explicit PerftHash(int bits) : mask((1ULL << bits) - 1), table(1ULL << bits) {}
+
+  bool get(Board &b, Color c, int depth, uint64_t *count) {
+    PerftEntry e = table[index(b, c, depth)];
+    if (e.check != (e.white ^ e.black ^ e.data)
+     || e.white != b.get_bits(WHITE) || e.black != b.get_bits(BLACK)
+     || (e.data & 0xFF) != meta(c, depth))
+      return false;
+    *count = e.data >> 8;
+    return true;
+  }
+
+  void add(Board &b, Color c, int depth, uint64_t count) {
+    PerftEntry &e = table[index(b, c, depth)];
+    uint64_t data = (count << 8) | meta(c, depth);
+    e.white = b.get_bits(WHITE);
+    e.black = b.get_bits(BLACK);
+    e.data = data;
+    e.check = e.white ^ e.black ^ data;
+  }
+
+ private:
+  struct PerftEntry {
+    uint64_t white, black, data, check;
+  };
+
+  uint64_t mask;
+  std::vector<PerftEntry> table;
+
+  static uint64_t meta(Color c, int depth) { return (uint64_t) (depth << 1 | c); }
+  uint64_t index(Board &b, Color c, int depth) {
+    return (b.hash() ^ (depth * 0x9E3779B9U) ^ (c * 0x85EBCA6BU)) & mask;
+  }
+};
+
+// A position at the split ply, with the number of lines that reach it
+struct PerftTask {
+  Board b;
+  Color c;
+  bool passed;
+  uint64_t lines;
+};
+
+// Gets the distinct positions plies from b, merging transpositions. Games
+// that end earlier are kept as tasks, which count as one leaf each.
+void split_perft(Board &b, Color c, int plies, bool passed, std::vector<PerftTask> &tasks) {
+  uint64_t legal = b.legal_moves(c);
+  if (plies == 0 || (!legal && passed)) {
+    for (unsigned int i = 0; i < tasks.size(); i++) {
+      if (tasks[i].c == c && tasks[i].passed == passed
+       && tasks[i].b.get_bits(WHITE) == b.get_bits(WHITE)
+       && tasks[i].b.get_bits(BLACK) == b.get_bits(BLACK)) {
+        tasks[i].lines++;
+        return;
+      }
+    }
+    tasks.push_back(PerftTask{b, c, passed, 1});
+    return;
+  }
+  if (!legal) {
+    split_perft(b, ~c, plies-1, true, tasks);
+    return;
+  }
+  while (legal) {
+    int m = bitscan_forward(legal);
+    legal &= legal - 1;
+    Board copy = b.copy();
+    copy.do_move(c, m);
+    split_perft(copy, ~c, plies-1, false, tasks);
+  }
+}
+
+}  // namespace
 
 // Performs a PERFT, which enumerates all possible lines of play up to a
 // certain number of plies. Useful for debugging the move generator and testing
-// speed/performance.
-uint64_t perft(Board &b, Color c, int depth, bool passed) {
+// speed/performance. The last ply is counted from the legal moves without
+// making them, and subtrees are looked up in cache, if given.
+uint64_t perft(Board &b, Color c, int depth, bool passed, PerftHash *cache) {
   if (depth == 0)
     return 1;
 
-  uint64_t nodes = 0;
-  ArrayList lm = b.legal_movelist(c);
-
-  if (lm.size() == 0) {
+  uint64_t legal = b.legal_moves(c);
+  if (!legal) {
     if (passed) return 1;
+    return perft(b, ~c, depth-1, true, cache);
+  }
+  if (depth == 1)
+    return count_bits(legal);
 
-    nodes += perft(b, ~c, depth-1, true);
+  uint64_t nodes = 0;
+  // Shallow subtrees are faster to count than to look up
+  bool use_cache = (cache != nullptr && depth >= 3);
+  if (use_cache && cache->get(b, c, depth, &nodes))
     return nodes;
-  }
 
-  for (int i = 0; i < lm.size(); i++) {
+  while (legal) {
+    int m = bitscan_forward(legal);
+    legal &= legal - 1;
     Board copy = b.copy();
-    copy.do_move(c, lm.get(i));
-    nodes += perft(copy, ~c, depth-1, false);
+    copy.do_move(c, m);
+    nodes += perft(copy, ~c, depth-1, false, cache);
   }
 
+  if (use_cache)
+    cache->add(b, c, depth, nodes);
+  return nodes;
+}
+
+uint64_t perft(Board &b, Color c, int depth, bool passed) {
+  return perft(b, c, depth, passed, nullptr);
+}
+
+// Splits the tree at a shallow ply and counts the distinct positions there on
+// threads, which share a 2^hash_bits entry cache. Without a cache, only the
+// transpositions at the split ply are merged.
+uint64_t parallel_perft(int depth, int threads, int hash_bits) {
+  Board start;
+  std::vector<PerftTask> tasks;
+  int split = std::min(depth, 5);
+  split_perft(start, BLACK, split, false, tasks);
+
+  PerftHash *cache = (hash_bits > 0) ? new PerftHash(hash_bits) : nullptr;
+  std::atomic<unsigned int> next_index(0);
+  std::atomic<uint64_t> nodes(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.push_back(std::thread([&]() {
+      for (unsigned int i = next_index++; i < tasks.size(); i = next_index++) {
+        PerftTask &task = tasks[i];
+        nodes += task.lines * perft(task.b, task.c, depth - split, task.passed, cache);
+      }
+    }));
+  }
+  for (unsigned int t = 0; t < workers.size(); t++)
+    workers[t].join();
+  delete cache;
   return nodes;
 }
 
@@ -380,3 +613,540 @@ std::vector<std::string> split(const std::string &s, char d) {
     }
     return v;
 }
+
+void multipv(std::string file, int depth, int k) {
+  std::ifstream cfile(file);
+  std::string line;
+  uint64_t total_nodes = 0;
+  auto start_time = Clock::now();
+
+  while (getline(cfile, line)) {
+    char board[64];
+    const char *read = line.c_str();
+    for (int j = 0; j < 64; j++)
+      board[j] = read[j];
+
+    std::vector<std::string> parts = split(line, ' ');
+    Color side = (parts[1] == "Black") ? BLACK : WHITE;
+
+    Player p(side, false, std::min(20, depth));
+    p.set_depths(depth, 0);
+    p.multiPv = k;
+    p.game = Board(board);
+    p.do_move(MOVE_NULL, -1);
+    total_nodes += p.get_nodes();
+
+    std::cerr << line.substr(0, 64) << " " << parts[1] << std::endl;
+    const std::vector<PVLine> &lines = p.get_lines();
+    for (unsigned int i = 0; i < lines.size(); i++) {
+      std::cerr << "  " << i+1 << ". " << ((double) lines[i].score) / EVAL_SCALE_FACTOR
+                << " " << print_pv(lines[i].pv) << std::endl;
+    }
+  }
+
+  std::cerr << "Nodes: " << total_nodes << std::endl;
+  std::cerr << "Total time: " << get_time_elapsed(start_time) << std::endl;
+}
+
+namespace {
+
+// Solves all positions, split between threads, and returns the time taken,
+// or 0 if any solution was incorrect.
+uint64_t solve_suite(const std::vector<EgPosition> &positions, const EndgameConfig &config,
+    int threads, uint64_t *nodes) {
+  // Each run is timed from empty tables
+  clear_endhash();
+  std::vector<Endgame> solvers(threads);
+  for (int t = 0; t < threads; t++)
+    solvers[t].config = config;
+
+  std::atomic<unsigned int> next_index(0);
+  std::atomic<bool> correct(true);
+  std::atomic<uint64_t> total_nodes(0);
+  auto start_time = Clock::now();
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.push_back(std::thread([&, t]() {
+      Endgame &eg = solvers[t];
+      for (unsigned int i = next_index++; i < positions.size(); i = next_index++) {
+        Board b = positions[i].b;
+        Eval e;
+        init_evaluator(b, &e);
+        ArrayList lm = b.legal_movelist(positions[i].side);
+        int score;
+        eg.solve_endgame(b, &e, positions[i].side, lm, false, b.count_empty(), 100000000, &score);
+        total_nodes += eg.nodes;
+        if (score != positions[i].score)
+          correct = false;
+      }
+    }));
+  }
+  for (unsigned int t = 0; t < workers.size(); t++)
+    workers[t].join();
+
+  *nodes = total_nodes;
+  return correct ? get_time_elapsed(start_time) : 0;
+}
+
+// The best time of a few runs, which is much less noisy than a single run
+uint64_t time_suite(const std::vector<EgPosition> &positions, const EndgameConfig &config,
+    int threads, uint64_t *nodes) {
+  const int RUNS = 2;
+  uint64_t best_ms = 0;
+  for (int i = 0; i < RUNS; i++) {
+    uint64_t ms = solve_suite(positions, config, threads, nodes);
+    if (ms == 0)
+      return 0;
+    if (best_ms == 0 || ms < best_ms)
+      best_ms = ms;
+  }
+  return best_ms;
+}
+
+// Changes one parameter of the config by step. Sort depth tables are shifted
+// along the depth axis, so that a positive step starts the same sort
+// searches one empty square earlier.
+EndgameConfig adjust(const EndgameConfig &config, int param, int step) {
+  EndgameConfig result = config;
+  switch (param) {
+    case 0:
+      result.endMedium += step;
+      break;
+    case 1:
+      result.endShallow += step;
+      break;
+    case 2:
+    case 3: {
+      const int *from = (param == 2) ? config.sortDepths : config.rootSortDepths;
+      int *to = (param == 2) ? result.sortDepths : result.rootSortDepths;
+      for (int d = 1; d < EndgameConfig::DEPTHS; d++)
+        to[d] = from[std::max(1, std::min(EndgameConfig::DEPTHS - 1, d + step))];
+      break;
+    }
+  }
+  return result;
+}
+
+// Measures the solve cost model of config for the time manager. The positions
+// are solved one at a time on one thread, as a Player solves, and the mean
+// nodes for each number of empties are fitted to
+// costNodes * costEbf^(empties - costEmpties) by least squares on the
+// logarithms. Fails if the positions do not have two different numbers of
+// empties.
+bool measure_cost(const std::vector<EgPosition> &positions, EndgameConfig &config) {
+  // Total nodes and number of positions for each number of empties
+  std::map<int, std::pair<double, int>> by_empties;
+  uint64_t total_nodes = 0;
+  clear_endhash();
+  Endgame eg;
+  eg.config = config;
+  auto start_time = Clock::now();
+  for (unsigned int i = 0; i < positions.size(); i++) {
+    Board b = positions[i].b;
+    Eval e;
+    init_evaluator(b, &e);
+    ArrayList lm = b.legal_movelist(positions[i].side);
+    eg.solve_endgame(b, &e, positions[i].side, lm, false, b.count_empty(), 100000000);
+    by_empties[b.count_empty()].first += eg.nodes;
+    by_empties[b.count_empty()].second++;
+    total_nodes += eg.nodes;
+  }
+  uint64_t ms = std::max((uint64_t) 1, get_time_elapsed(start_time));
+  if (by_empties.size() < 2)
+    return false;
+
+  double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (auto it = by_empties.begin(); it != by_empties.end(); ++it) {
+    double w = it->second.second;
+    double x = it->first;
+    double y = std::log(it->second.first / it->second.second);
+    sw += w;
+    sx += w * x;
+    sy += w * y;
+    sxx += w * x * x;
+    sxy += w * x * y;
+  }
+  double slope = (sw * sxy - sx * sy) / (sw * sxx - sx * sx);
+  double intercept = (sy - slope * sx) / sw;
+  config.costEmpties = by_empties.begin()->first;
+  config.costNodes = std::exp(intercept + slope * config.costEmpties);
+  config.costEbf = std::max(1.0, std::exp(slope));
+  config.costNps = 1000 * total_nodes / ms;
+  return true;
+}
+
+}  // namespace
+
+// Tunes the endgame solver depths on this machine by coordinate descent: each
+// parameter is moved one step at a time while the eg suite solves faster. A
+// change must save 3% to be kept, so that timing noise is not tuned.
+bool tune(std::string file, int threads, std::string out_file) {
+  const char *PARAM_NAMES[4] = { "end_medium", "end_shallow", "sort_depths", "root_sort_depths" };
+  std::vector<EgPosition> positions = read_eg_positions(file);
+  if (positions.empty()) {
+    std::cerr << "Error: could not read " << file << std::endl;
+    return false;
+  }
+
+  EndgameConfig best = endgameConfig;
+  uint64_t nodes;
+  uint64_t best_ms = time_suite(positions, best, threads, &nodes);
+  if (best_ms == 0) {
+    std::cerr << "Error: incorrect solution with the starting config" << std::endl;
+    return false;
+  }
+  std::cerr << "Start: " << best_ms << " ms | nodes " << nodes << std::endl;
+
+  bool improved = true;
+  for (int pass = 0; pass < 3 && improved; pass++) {
+    improved = false;
+    for (int param = 0; param < 4; param++) {
+      for (int step = -1; step <= 1; step += 2) {
+        // Keep stepping in this direction while it helps
+        while (true) {
+          EndgameConfig trial = adjust(best, param, step);
+          if (!trial.valid())
+            break;
+          uint64_t ms = time_suite(positions, trial, threads, &nodes);
+          std::cerr << PARAM_NAMES[param] << " " << (step > 0 ? "+1" : "-1") << ": "
+                    << ms << " ms | nodes " << nodes << std::endl;
+          if (ms == 0) {
+            std::cerr << "Error: incorrect solution" << std::endl;
+            return false;
+          }
+          if (ms * 100 >= best_ms * 97)
+            break;
+          best = trial;
+          best_ms = ms;
+          improved = true;
+        }
+      }
+    }
+  }
+
+  std::cerr << "Best: " << best_ms << " ms | end_medium " << best.endMedium
+            << " | end_shallow " << best.endShallow << std::endl;
+  // The time manager's solve cost model, for the tuned depths
+  if (measure_cost(positions, best)) {
+    std::cerr << "Cost model: " << best.costNodes << " nodes at " << best.costEmpties
+              << " empties | EBF " << best.costEbf << " | NPS " << best.costNps << std::endl;
+  }
+  if (!best.write_file(out_file)) {
+    std::cerr << "Error: could not write " << out_file << std::endl;
+    return false;
+  }
+  std::cerr << "Wrote " << out_file << std::endl;
+  return true;
+}
+
+namespace {
+
+// One timed run of a report case
+struct CaseRun {
+  uint64_t ms;
+  uint64_t nodes;
+  // 1 if the result matches the known solution, 0 if not, and -1 if there is
+  // no known solution
+  int correct;
+  // Permille of the main hash table in use afterwards, or -1 if none
+  int ttFill;
+  // Score error in discs, only for eval_acc
+  int error;
+};
+
+struct ReportCase {
+  std::string id;
+  std::function<CaseRun()> run;
+};
+
+CaseRun solve_case(const Board &position, Color side, int solution, bool has_solution, int threads) {
+  Board b = position;
+  Eval e;
+  init_evaluator(b, &e);
+  ArrayList lm = b.legal_movelist(side);
+
+  clear_endhash();
+  Endgame eg;
+  eg.threads = threads;
+  eg.config = endgameConfig;
+  int score;
+  auto start_time = Clock::now();
+  eg.solve_endgame(b, &e, side, lm, false, b.count_empty(), 100000000, &score);
+  uint64_t ms = get_time_elapsed(start_time);
+  int correct = has_solution ? (score == solution) : -1;
+  return CaseRun{ms, eg.nodes, correct, endhash_full(), 0};
+}
+
+// Builds the cases of a suite, or returns false for an unknown suite
+bool report_cases(const std::string &suite, int arg, int threads, std::vector<ReportCase> &cases) {
+  if (suite == "perft") {
+    cases.push_back(ReportCase{"perft " + std::to_string(arg), [arg, threads]() {
+      auto start_time = Clock::now();
+      uint64_t nodes = parallel_perft(arg, threads, 20);
+      uint64_t ms = get_time_elapsed(start_time);
+      int correct = (arg < 15) ? (nodes == PERFT_COUNTS[arg]) : -1;
+      return CaseRun{ms, nodes, correct, -1, 0};
+    }});
+  } else if (suite == "bench") {
+    std::ifstream cfile("Flippy_Resources/bench.txt");
+    std::string line;
+    while (getline(cfile, line)) {
+      std::vector<std::string> parts = split(line, ' ');
+      Board b(line.substr(0, 64));
+      Color side = (parts[1] == "Black") ? BLACK : WHITE;
+      cases.push_back(ReportCase{std::to_string(cases.size() + 1), [b, side, arg, threads]() {
+        Player p(side, false, std::min(20, arg));
+        p.set_threads(threads);
+        p.set_depths(arg, 0);
+        p.game = b;
+        auto start_time = Clock::now();
+        p.do_move(MOVE_NULL, -1);
+        uint64_t ms = get_time_elapsed(start_time);
+        return CaseRun{ms, p.get_nodes(), -1, p.transpositionTable->hash_full(), 0};
+      }});
+    }
+  } else if (suite == "ffo") {
+    resize_endhash(14);
+    for (int i = 0; i < arg; i++) {
+      std::string file = "ffotest/end" + std::to_string(40 + i) + ".pos";
+      Board b;
+      Color side;
+      std::string comment;
+      if (!read_ffo_position(file, &b, &side, &comment)) {
+        std::cerr << "Error: could not read " << file << std::endl;
+        continue;
+      }
+      int solution = 0;
+      bool has_solution = ffo_solution(comment, &solution);
+      cases.push_back(ReportCase{"end" + std::to_string(40 + i),
+          [b, side, solution, has_solution, threads]() {
+        return solve_case(b, side, solution, has_solution, threads);
+      }});
+    }
+  } else if (suite == "eg") {
+    std::vector<EgPosition> positions = read_eg_positions(eg_suite(arg));
+    for (unsigned int i = 0; i < positions.size(); i++) {
+      EgPosition p = positions[i];
+      cases.push_back(ReportCase{std::to_string(i + 1), [p, threads]() {
+        return solve_case(p.b, p.side, p.score, true, threads);
+      }});
+    }
+  } else if (suite == "eval_acc") {
+    std::vector<EgPosition> positions;
+    const char *files[3] = { "ffotest/eg_17_18.txt", "ffotest/eg_19_20.txt", "ffotest/eg_21_22.txt" };
+    for (int f = 0; f < 3; f++) {
+      std::vector<EgPosition> more = read_eg_positions(files[f]);
+      positions.insert(positions.end(), more.begin(), more.end());
+    }
+    for (unsigned int i = 0; i < positions.size(); i++) {
+      EgPosition p = positions[i];
+      cases.push_back(ReportCase{std::to_string(i + 1), [p, arg]() {
+        Board b = p.b;
+        ArrayList lm = b.legal_movelist(p.side);
+        Hash tt(12);
+        SearchInfo search_info;
+        search_info.tt = &tt;
+        search_info.other_heuristic = true;
+        Eval e;
+        init_evaluator(b, &e);
+        int score = 0;
+        auto start_time = Clock::now();
+        for (int depth = 1; depth <= arg; depth++) {
+          int best = pvs_best_move(b, &e, p.side, lm, &score, depth, &search_info);
+          lm.swap(best, 0);
+        }
+        uint64_t ms = get_time_elapsed(start_time);
+        return CaseRun{ms, search_info.nodes, -1, tt.hash_full(),
+          score / EVAL_SCALE_FACTOR - p.score};
+      }});
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+double median(std::vector<uint64_t> v) {
+  std::sort(v.begin(), v.end());
+  size_t n = v.size();
+  return (n % 2) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2.0;
+}
+
+double stddev(const std::vector<uint64_t> &v) {
+  if (v.size() < 2)
+    return 0.0;
+  double mean = 0.0;
+  for (unsigned int i = 0; i < v.size(); i++)
+    mean += v[i];
+  mean /= v.size();
+  double sum = 0.0;
+  for (unsigned int i = 0; i < v.size(); i++)
+    sum += (v[i] - mean) * (v[i] - mean);
+  return std::sqrt(sum / (v.size() - 1));
+}
+
+// Reads a number after "key": in a line of a report. Reports put each case
+// on its own line, so that baselines can be read without a JSON parser.
+bool json_field(const std::string &line, const std::string &key, double *value) {
+  size_t pos = line.find("\"" + key + "\":");
+  if (pos == std::string::npos)
+    return false;
+  *value = std::atof(line.c_str() + pos + key.size() + 3);
+  return true;
+}
+
+bool json_id(const std::string &line, std::string *id) {
+  size_t pos = line.find("\"id\":\"");
+  if (pos == std::string::npos)
+    return false;
+  size_t end = line.find('"', pos + 6);
+  *id = line.substr(pos + 6, end - pos - 6);
+  return true;
+}
+
+}  // namespace
+
+// Runs every case of a suite reps times, and writes a JSON report with the
+// median and standard deviation of each case's time, its nodes and NPS, its
+// correctness if the solution is known, and the hash table fill in percent.
+// With a baseline report,
+// cases and totals slower by more than the threshold are flagged. Returns 1
+// if any result was incorrect or the total time regressed.
+int report(int argc, char **argv) {
+  std::string suite = argv[2];
+  int arg = std::stoi(argv[3]);
+  int reps = 3;
+  int threads = 1;
+  std::string out_file, baseline_file;
+  double threshold = 5.0;
+  for (int i = 4; i + 1 < argc; i += 2) {
+    std::string opt = argv[i];
+    if (opt == "-r") reps = std::max(1, std::stoi(argv[i+1]));
+    else if (opt == "-t") threads = std::max(1, std::stoi(argv[i+1]));
+    else if (opt == "-o") out_file = argv[i+1];
+    else if (opt == "-b") baseline_file = argv[i+1];
+    else if (opt == "-x") threshold = std::stod(argv[i+1]);
+    else {
+      usage();
+      return 1;
+    }
+  }
+
+  std::vector<ReportCase> cases;
+  if (!report_cases(suite, arg, threads, cases) || cases.empty()) {
+    std::cerr << "Error: no cases for " << suite << " " << arg << std::endl;
+    return 1;
+  }
+
+  // Each repetition runs the whole suite, so that slow drifts in machine
+  // speed affect all cases alike
+  std::vector<std::vector<CaseRun>> runs(cases.size());
+  std::vector<uint64_t> total_ms(reps, 0);
+  for (int r = 0; r < reps; r++) {
+    std::cerr << "Repetition " << r + 1 << " of " << reps << std::endl;
+    for (unsigned int i = 0; i < cases.size(); i++) {
+      CaseRun run = cases[i].run();
+      runs[i].push_back(run);
+      total_ms[r] += run.ms;
+    }
+  }
+
+  // Read the baseline medians, by case id
+  std::vector<std::pair<std::string, double>> baseline;
+  double baseline_total = 0.0;
+  if (!baseline_file.empty()) {
+    std::ifstream in(baseline_file);
+    if (!in.is_open()) {
+      std::cerr << "Error: could not read baseline " << baseline_file << std::endl;
+      return 1;
+    }
+    std::string line;
+    double value;
+    std::string id;
+    while (getline(in, line)) {
+      if (json_id(line, &id) && json_field(line, "median_ms", &value))
+        baseline.push_back(std::make_pair(id, value));
+      else if (line.find("\"total\":") != std::string::npos && json_field(line, "median_ms", &value))
+        baseline_total = value;
+    }
+  }
+
+  std::stringstream out;
+  out << "{\"suite\":\"" << suite << "\",\"arg\":" << arg << ",\"reps\":" << reps
+      << ",\"threads\":" << threads << ",\"cases\":[" << std::endl;
+  uint64_t total_nodes = 0;
+  int correct = 0, incorrect = 0, regressions = 0;
+  for (unsigned int i = 0; i < cases.size(); i++) {
+    std::vector<uint64_t> ms;
+    for (int r = 0; r < reps; r++)
+      ms.push_back(runs[i][r].ms);
+    const CaseRun &last = runs[i][reps - 1];
+    double med = median(ms);
+    total_nodes += last.nodes;
+
+    out << "{\"id\":\"" << cases[i].id << "\",\"ms\":[";
+    for (int r = 0; r < reps; r++)
+      out << (r ? "," : "") << ms[r];
+    out << "],\"median_ms\":" << med << ",\"stddev_ms\":" << stddev(ms)
+        << ",\"nodes\":" << last.nodes
+        << ",\"nps\":" << (uint64_t) (1000 * last.nodes / std::max(1.0, med));
+    if (last.correct >= 0) {
+      out << ",\"correct\":" << (last.correct ? "true" : "false");
+      if (last.correct)
+        correct++;
+      else
+        incorrect++;
+    }
+    if (last.ttFill >= 0)
+      out << ",\"tt_fill\":" << last.ttFill / 10.0;
+    if (suite == "eval_acc")
+      out << ",\"error\":" << last.error;
+    // Small times are too noisy to flag on their own
+    for (unsigned int j = 0; j < baseline.size(); j++) {
+      if (baseline[j].first != cases[i].id)
+        continue;
+      out << ",\"baseline_ms\":" << baseline[j].second;
+      if (med > baseline[j].second * (1 + threshold / 100) && med - baseline[j].second >= 10) {
+        out << ",\"regression\":true";
+        regressions++;
+      }
+      break;
+    }
+    out << "}" << (i + 1 < cases.size() ? "," : "") << std::endl;
+  }
+
+  double total = median(total_ms);
+  bool total_regression = baseline_total > 0
+    && total > baseline_total * (1 + threshold / 100);
+  out << "],\"total\":{\"median_ms\":" << total << ",\"stddev_ms\":" << stddev(total_ms)
+      << ",\"nodes\":" << total_nodes
+      << ",\"nps\":" << (uint64_t) (1000 * total_nodes / std::max(1.0, total))
+      << ",\"correct\":" << correct << ",\"incorrect\":" << incorrect;
+  if (baseline_total > 0) {
+    out << ",\"baseline_ms\":" << baseline_total
+        << ",\"change\":" << (total / baseline_total - 1)
+        << ",\"case_regressions\":" << regressions
+        << ",\"regression\":" << (total_regression ? "true" : "false");
+  }
+  out << "}}" << std::endl;
+
+  if (out_file.empty()) {
+    std::cout << out.str();
+  } else {
+    std::ofstream file(out_file);
+    file << out.str();
+  }
+
+  std::cerr << "Total: " << total << " ms median | " << total_nodes << " nodes";
+  if (correct + incorrect > 0)
+    std::cerr << " | " << incorrect << " incorrect";
+  std::cerr << std::endl;
+  if (baseline_total > 0) {
+    std::cerr << "Baseline: " << baseline_total << " ms | " << regressions
+              << " cases slower by " << threshold << "%" << std::endl;
+    if (total_regression)
+      std::cerr << "Regression: total time is " << 100 * (total / baseline_total - 1)
+                << "% slower" << std::endl;
+  }
+  return (incorrect > 0 || total_regression) ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+#include "timeman.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Default endgame node model, measured with testsuites eg on a 7700K, for
+// when no tuned model is set: an exact solve at EG_BASE_EMPTIES empties takes
+// EG_BASE_NODES nodes, and each additional empty square multiplies this by
+// EG_EBF. A WLD solve takes about WLD_FACTOR of an exact solve.
+const int EG_BASE_EMPTIES = 14;
+const double EG_BASE_NODES = 85000.0;
+const double EG_EBF = 2.4;
+const double WLD_FACTOR = 0.2;
+
+const double DEFAULT_EBF = 3.0;
+const uint64_t DEFAULT_MIDGAME_NPS = 2000000;
+const uint64_t DEFAULT_ENDGAME_NPS = 15000000;
+
+// Weight of the newest sample in the moving averages.
+const double LEARN_RATE = 0.3;
+// Iterations smaller than this are too noisy to fit on.
+const uint64_t MIN_FIT_NODES = 2000;
+const uint64_t MIN_FIT_MS = 10;
+
+}  // namespace
+
+TimeManager::TimeManager() {
+  for (int i = 0; i < TM_PHASES; i++)
+    ebf[i] = DEFAULT_EBF;
+  egBaseEmpties = EG_BASE_EMPTIES;
+  egBaseNodes = EG_BASE_NODES;
+  egEbf = EG_EBF;
+  egCorrection = 1.0;
+  midgameNps = DEFAULT_MIDGAME_NPS;
+  endgameNps = DEFAULT_ENDGAME_NPS;
+  start_move(60, 0, 0);
+}
+
+void TimeManager::start_move(int e, uint64_t a, uint64_t l) {
+  empties = e;
+  allotment = a;
+  limit = l;
+  lastNodes = 0;
+  lastMs = 0;
+  iterations = 0;
+  adjustment = 1.0;
+  if (log.is_open())
+    log << "move " << empties << " " << allotment << " " << limit << std::endl;
+}
+
+void TimeManager::set_budget(uint64_t a, uint64_t l) {
+  allotment = a;
+  limit = l;
+  if (log.is_open())
+    log << "budget " << allotment << " " << limit << std::endl;
+}
+
+void TimeManager::set_allotment(uint64_t a) {
+  allotment = a;
+  if (log.is_open())
+    log << "allot " << allotment << std::endl;
+}
+
+void TimeManager::record_iteration(int depth, uint64_t nodes, uint64_t ms, bool best_changed) {
+  if (log.is_open())
+    log << "iter " << depth << " " << nodes << " " << ms << " " << best_changed << std::endl;
+
+  int p = phase(empties);
+  if (iterations > 0 && lastNodes >= MIN_FIT_NODES) {
+    double ratio = std::max(1.0, std::min(20.0, (double) nodes / lastNodes));
+    ebf[p] = (1 - LEARN_RATE) * ebf[p] + LEARN_RATE * ratio;
+  }
+  if (ms >= MIN_FIT_MS)
+    midgameNps = (1 - LEARN_RATE) * midgameNps + LEARN_RATE * (1000 * nodes / ms);
+
+  // Spend more time when the best move is unstable, and less when it is stable.
+  adjustment = (2 * adjustment + 1) / 3;
+  if (!best_changed) {
+    adjustment *= 0.8;
+  } else {
+    if (adjustment < 1.0) adjustment = 1.0;
+    adjustment *= 1.7;
+    if (adjustment > 2.5) adjustment = 2.5;
+  }
+
+  lastNodes = nodes;
+  lastMs = ms;
+  iterations++;
+}
+
+void TimeManager::record_endgame(int e, bool wld, uint64_t nodes, uint64_t ms, bool completed) {
+  if (log.is_open())
+    log << "eg " << e << " " << wld << " " << nodes << " " << ms << " " << completed << std::endl;
+
+  if (ms >= MIN_FIT_MS)
+    endgameNps = (1 - LEARN_RATE) * endgameNps + LEARN_RATE * (1000 * nodes / ms);
+
+  // A broken out solve only gives a lower bound on its cost
+  double ratio = (double) std::max((uint64_t) 1, nodes) / endgame_nodes(e, wld);
+  if (completed || ratio > 1.0) {
+    egCorrection *= std::pow(ratio, LEARN_RATE);
+    egCorrection = std::max(0.05, std::min(20.0, egCorrection));
+  }
+}
+
+bool TimeManager::should_start_iteration(uint64_t elapsed) {
+  uint64_t finish = elapsed + predict_iteration_ms();
+  return finish < allotment * adjustment && (limit == 0 || finish < limit);
+}
+
+uint64_t TimeManager::predict_iteration_ms() {
+  if (iterations == 0)
+    return 0;
+  double next_nodes = lastNodes * ebf[phase(empties)];
+  // Time scales with nodes, but very short iterations are dominated by noise
+  if (lastMs >= MIN_FIT_MS)
+    return (uint64_t) (lastMs * next_nodes / std::max((uint64_t) 1, lastNodes));
+  return (uint64_t) (1000 * next_nodes / midgameNps);
+}
+
+uint64_t TimeManager::predict_endgame_ms(int e, bool wld) {
+  return 1000 * endgame_nodes(e, wld) / endgameNps;
+}
+
+bool TimeManager::can_solve_endgame(int e, bool wld, uint64_t budget) {
+  return predict_endgame_ms(e, wld) <= budget;
+}
+
+void TimeManager::set_endgame_model(int base_empties, double base_nodes, double eg_ebf, uint64_t nps) {
+  egBaseEmpties = base_empties;
+  egBaseNodes = base_nodes;
+  egEbf = eg_ebf;
+  endgameNps = nps;
+  egCorrection = 1.0;
+}
+
+double TimeManager::get_ebf() {
+  return ebf[phase(empties)];
+}
+
+void TimeManager::set_log(const std::string &file) {
+  log.open(file, std::ios::app);
+  if (log.is_open())
+    log << "egmodel " << egBaseEmpties << " " << egBaseNodes << " " << egEbf << " "
+        << endgameNps << std::endl;
+}
+
+uint64_t TimeManager::endgame_nodes(int e, bool wld) {
+  double nodes = egBaseNodes * std::pow(egEbf, e - egBaseEmpties) * egCorrection;
+  if (wld)
+    nodes *= WLD_FACTOR;
+  return (uint64_t) nodes;
+}
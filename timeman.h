@@ -0,0 +1,83 @@
+#ifndef __TIMEMAN_H__
+#define __TIMEMAN_H__
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include "common.h"
+
+// Game phases for the branching factor model, by number of empty squares.
+const int TM_PHASES = 7;
+
+// Decides how to spend the time allotted to a move. Each search iteration is
+// recorded, and an effective branching factor (EBF) is fitted per game phase
+// to predict the cost of the next iteration. Endgame solves are predicted from
+// the number of empties with a node model that is corrected by the measured
+// endgame solves and NPS.
+class TimeManager {
+ public:
+  TimeManager();
+  ~TimeManager() = default;
+
+  // Starts timing a move. allotment is the fair share of time for this move
+  // and limit the hard limit, both in ms. A limit of 0 means no limit.
+  void start_move(int empties, uint64_t allotment, uint64_t limit);
+  // Replaces the allotment and limit of the move being timed, keeping its
+  // iterations. Used on a ponder hit, when the time of the move is known.
+  void set_budget(uint64_t allotment, uint64_t limit);
+  // Replaces the allotment of the move being timed, on the same clock. Used
+  // when a broken endgame solve leaves the time to the midgame search.
+  void set_allotment(uint64_t allotment);
+  // Records a finished iteration of the midgame search. best_changed is
+  // whether the best move differs from the previous iteration's.
+  void record_iteration(int depth, uint64_t nodes, uint64_t ms, bool best_changed);
+  // Records a finished (or broken out of) endgame solve.
+  void record_endgame(int empties, bool wld, uint64_t nodes, uint64_t ms, bool completed);
+
+  // Whether another iteration is expected to finish within the allotment,
+  // given the time already spent on this move.
+  bool should_start_iteration(uint64_t elapsed);
+  // Predicted cost of the next iteration, in ms.
+  uint64_t predict_iteration_ms();
+  // Predicted cost of solving an endgame with the given empties, in ms.
+  uint64_t predict_endgame_ms(int empties, bool wld);
+  // Whether an endgame solve is expected to finish within budget ms.
+  bool can_solve_endgame(int empties, bool wld, uint64_t budget);
+
+  // Replaces the default endgame node model: an exact solve at base_empties
+  // takes base_nodes nodes, each further empty square multiplies this by eg_ebf,
+  // and solves search nps nodes per second. From testsuites tune, through
+  // the endgame config.
+  void set_endgame_model(int base_empties, double base_nodes, double eg_ebf, uint64_t nps);
+
+  double get_ebf();
+  uint64_t get_allotment() { return allotment; }
+  uint64_t get_limit() { return limit; }
+
+  // Appends all records to the given file, for use with timereplay. The
+  // endgame node model is written first, so that a replay uses the same one.
+  void set_log(const std::string &file);
+
+ private:
+  double ebf[TM_PHASES];
+  int egBaseEmpties;
+  double egBaseNodes, egEbf;
+  // Multiplicative correction to the endgame node model, fitted online
+  double egCorrection;
+  uint64_t midgameNps, endgameNps;
+
+  int empties;
+  uint64_t allotment, limit;
+  uint64_t lastNodes, lastMs;
+  int iterations;
+  // Scales the allotment up when the best move is unstable, and down when it
+  // is stable.
+  double adjustment;
+
+  std::ofstream log;
+
+  int phase(int e) { return std::min(TM_PHASES - 1, e / 10); }
+  uint64_t endgame_nodes(int e, bool wld);
+};
+
+#endif
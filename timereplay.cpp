@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "common.h"
+#include "timeman.h"
+
+// Replays a time log written by Player::set_time_log (FlippyT -l) through a
+// fresh TimeManager, and reports how well its predictions and decisions
+// match what the logged searches actually cost.
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    std::cerr << "Usage: timereplay [time log]" << std::endl;
+    return 1;
+  }
+  std::ifstream in(argv[1]);
+  if (!in.is_open()) {
+    std::cerr << "Error: could not open " << argv[1] << std::endl;
+    return 1;
+  }
+
+  TimeManager tm;
+  uint64_t allotment = 0;
+  uint64_t limit = 0;
+  uint64_t elapsed = 0;
+
+  int moves = 0;
+  // Midgame iterations: prediction error, and decisions compared to whether
+  // the iteration actually finished within the allotment
+  int iterations = 0, predicted_iterations = 0;
+  double iter_log_error = 0;
+  int iter_started_fit = 0, iter_started_overshot = 0;
+  int iter_skipped_fit = 0, iter_skipped_overshot = 0;
+  // Endgame solves, and the ones that completed, which have an error
+  int solves = 0, completed_solves = 0;
+  double eg_log_error = 0;
+  int eg_started_fit = 0, eg_started_overshot = 0;
+  int eg_skipped_fit = 0, eg_skipped_overshot = 0;
+
+  std::string line;
+  while (getline(in, line)) {
+    std::stringstream ss(line);
+    std::string type;
+    ss >> type;
+    if (type == "egmodel") {
+      int base_empties;
+      double base_nodes, ebf;
+      uint64_t nps;
+      ss >> base_empties >> base_nodes >> ebf >> nps;
+      tm.set_endgame_model(base_empties, base_nodes, ebf, nps);
+    } else if (type == "move") {
+      int empties;
+      ss >> empties >> allotment >> limit;
+      tm.start_move(empties, allotment, limit);
+      elapsed = 0;
+      moves++;
+    } else if (type == "budget") {
+      // A ponder hit: the move is timed from here on
+      ss >> allotment >> limit;
+      tm.set_budget(allotment, limit);
+      elapsed = 0;
+    } else if (type == "allot") {
+      // More time for the midgame search after a broken solve, on the same
+      // clock
+      ss >> allotment;
+      tm.set_allotment(allotment);
+    } else if (type == "iter") {
+      int depth, best_changed;
+      uint64_t nodes, ms;
+      ss >> depth >> nodes >> ms >> best_changed;
+      uint64_t predicted = tm.predict_iteration_ms();
+      bool start = tm.should_start_iteration(elapsed);
+      bool fit = elapsed + ms < allotment;
+      // The first iteration of a move has no prediction
+      if (predicted > 0) {
+        iter_log_error += std::fabs(std::log((predicted + 1.0) / (ms + 1.0)));
+        predicted_iterations++;
+        if (start && fit) iter_started_fit++;
+        else if (start) iter_started_overshot++;
+        else if (fit) iter_skipped_fit++;
+        else iter_skipped_overshot++;
+      }
+      tm.record_iteration(depth, nodes, ms, best_changed);
+      elapsed += ms;
+      iterations++;
+    } else if (type == "eg") {
+      int empties, wld, completed;
+      uint64_t nodes, ms;
+      ss >> empties >> wld >> nodes >> ms >> completed;
+      uint64_t predicted = tm.predict_endgame_ms(empties, wld);
+      // The budget think() decides on: the allotment for an exact solve,
+      // which is decided at the start of the move, and what is left of the
+      // allotment and limit for a WLD solve, after the midgame search
+      uint64_t budget = allotment;
+      if (wld) {
+        if (limit != 0)
+          budget = std::min(budget, limit);
+        budget = (budget > elapsed) ? budget - elapsed : 0;
+      }
+      bool start = tm.can_solve_endgame(empties, wld, budget);
+      bool fit = completed && ms <= budget;
+      if (completed) {
+        eg_log_error += std::fabs(std::log((predicted + 1.0) / (ms + 1.0)));
+        completed_solves++;
+      }
+      if (start && fit) eg_started_fit++;
+      else if (start) eg_started_overshot++;
+      else if (fit) eg_skipped_fit++;
+      else eg_skipped_overshot++;
+      tm.record_endgame(empties, wld, nodes, ms, completed);
+      elapsed += ms;
+      solves++;
+    }
+  }
+
+  std::cerr << "Moves: " << moves << " | Iterations: " << iterations
+            << " | Endgame solves: " << solves << std::endl;
+  if (predicted_iterations > 0) {
+    std::cerr << "Iteration time: mean |log(predicted/actual)| "
+              << iter_log_error / predicted_iterations << std::endl;
+  }
+  std::cerr << "Iterations started: " << iter_started_fit << " fit, "
+            << iter_started_overshot << " overshot" << std::endl;
+  std::cerr << "Iterations skipped: " << iter_skipped_fit << " would have fit, "
+            << iter_skipped_overshot << " would have overshot" << std::endl;
+  if (completed_solves > 0) {
+    std::cerr << "Endgame time: mean |log(predicted/actual)| "
+              << eg_log_error / completed_solves << " over " << completed_solves
+              << " completed" << std::endl;
+  }
+  std::cerr << "Endgame solves started: " << eg_started_fit << " fit, "
+            << eg_started_overshot << " overshot" << std::endl;
+  std::cerr << "Endgame solves skipped: " << eg_skipped_fit << " would have fit, "
+            << eg_skipped_overshot << " would have overshot" << std::endl;
+  return 0;
+}
@@ -7,8 +7,19 @@ using namespace std;
 
 int main(int argc, char *argv[]) {
   // Read in side the player is on.
-  if (argc != 2)  {
-    cerr << "usage: " << argv[0] << " side" << endl;
+  bool ponder = false;
+  uint64_t hash_mb = 0;
+  bool usage = (argc < 2);
+  for (int i = 2; i < argc && !usage; i++) {
+    if (!strcmp(argv[i], "-p"))
+      ponder = true;
+    else if (!strcmp(argv[i], "--hash-mb") && i + 1 < argc)
+      hash_mb = strtoull(argv[++i], nullptr, 10);
+    else
+      usage = true;
+  }
+  if (usage) {
+    cerr << "usage: " << argv[0] << " side [-p] [--hash-mb mb]" << endl;
     exit(-1);
   }
   Color side = (!strcmp(argv[1], "Black")) ? BLACK : WHITE;
@@ -18,7 +29,11 @@ int main(int argc, char *argv[]) {
   Player *player = new Player(side, true, /*tt_bits=*/20);
   // The Java GUI does terribly at handling overhead time.
   player->bufferPerMove = 50;
-  resize_endhash(14);
+  if (hash_mb > 0)
+    player->set_hash_mb(hash_mb);
+  else
+    resize_endhash(14);
+  player->print_hash_memory(cerr);
 
   // Tell java wrapper that we are done initializing.
   cout << "Init done" << endl;
@@ -42,7 +57,13 @@ int main(int argc, char *argv[]) {
     }
     cout.flush();
     cerr.flush();
+
+    // Search on the opponent's time while we wait for their move.
+    if (ponder)
+      player->start_pondering();
   }
 
+  if (ponder)
+    cerr << player->ponder_stats() << endl;
   return 0;
 }